@@ -0,0 +1,80 @@
+#include <audio-buffer.h>
+#include <mix-kernels.h>
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#define BENCH_STEM_FRAMES (AUDIO_SAMPLE_RATE * 60)
+#define BENCH_REPEATS 20
+
+using bench_clock = std::chrono::steady_clock;
+
+// The per-sample loop that was used before the kernels existed
+static void accumulate_reference(const int16_t* source, int first_frame, int stem_length,
+    float gain_l, float gain_r, float* left, float* right, int frames)
+{
+    int stem_sample = first_frame;
+
+    for (int i = 0; i < frames; ++i, ++stem_sample) {
+        if (stem_sample < 0 || stem_sample >= stem_length) {
+            continue;
+        }
+
+        left[i] += source[2 * stem_sample] * gain_l;
+        right[i] += source[2 * stem_sample + 1] * gain_r;
+    }
+}
+
+template <typename FunType>
+static double measure_frames_per_second(int block_frames, FunType render_block)
+{
+    auto start = bench_clock::now();
+
+    for (int repeat = 0; repeat < BENCH_REPEATS; ++repeat) {
+        for (int frame = 0; frame + block_frames <= BENCH_STEM_FRAMES; frame += block_frames) {
+            render_block(frame);
+        }
+    }
+
+    std::chrono::duration<double> elapsed = bench_clock::now() - start;
+    double frames = static_cast<double>(BENCH_STEM_FRAMES / block_frames * block_frames) * BENCH_REPEATS;
+    return frames / elapsed.count();
+}
+
+int main()
+{
+    std::mt19937 random(2137);
+    std::uniform_int_distribution<int> distribution(-32768, 32767);
+
+    std::vector<int16_t> stem(2 * BENCH_STEM_FRAMES);
+    for (int16_t& sample : stem) {
+        sample = distribution(random);
+    }
+
+    audio_block block = {};
+    const float gain_l = 0.7f / 32768.f;
+    const float gain_r = 0.9f / 32768.f;
+
+    printf("Mix kernel variant: %s\n", MixKernels::variant());
+    printf("%12s %20s %20s %8s\n", "block", "reference [fps]", "kernel [fps]", "speedup");
+
+    for (int block_frames : { AUDIO_CHUNK_SAMPLES, 512, AUDIO_MAX_BLOCK_SAMPLES }) {
+        double reference = measure_frames_per_second(block_frames, [&](int frame) {
+            accumulate_reference(stem.data(), frame, BENCH_STEM_FRAMES, gain_l, gain_r,
+                block.left_channel, block.right_channel, block_frames);
+        });
+
+        double kernel = measure_frames_per_second(block_frames, [&](int frame) {
+            MixKernels::accumulate_stereo(stem.data() + 2 * frame, block_frames, gain_l, gain_r,
+                block.left_channel, block.right_channel);
+        });
+
+        printf("%12d %20.0f %20.0f %7.2fx\n", block_frames, reference, kernel, kernel / reference);
+    }
+
+    // Keep the accumulated output alive
+    printf("(checksum %f)\n", block.left_channel[0] + block.right_channel[0]);
+    return 0;
+}
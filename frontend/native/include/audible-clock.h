@@ -0,0 +1,38 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+/**
+ * \class
+ * \brief This class publishes which song sample is leaving the audio worklet
+ *        and at what AudioContext time
+ * 
+ * It is written by the worklet once per quantum and read directly from
+ * the wasm heap by JS (see `useAudiblePosition`), so the UI can interpolate
+ * the playhead every frame without calling into the module. The record is
+ * guarded by a sequence number: it is odd while an update is in progress.
+ * 
+ * Memory layout (byte offsets, must match the JS side):
+ *   0: double   context_time
+ *   8: uint32_t sequence
+ *  12: uint32_t position
+ *  16: uint32_t playing
+ */
+class AudibleClock {
+public:
+    AudibleClock();
+
+    void publish(double context_time, uint32_t position, bool playing);
+    uintptr_t address() const;
+
+private:
+    struct alignas(8) record {
+        double context_time;
+        uint32_t sequence;
+        uint32_t position;
+        uint32_t playing;
+        uint32_t padding;
+    };
+
+    record _record;
+};
@@ -1,40 +1,117 @@
 #pragma once
-#include <spin-lock.h>
-
 #include <atomic>
-#include <condition_variable>
+#include <cstdint>
 #include <memory>
-#include <mutex>
 
 #define AUDIO_CHUNK_SAMPLES 128
 #define AUDIO_SAMPLE_RATE 44100
+#define AUDIO_MAX_BLOCK_SAMPLES 1024
 
 struct audio_chunk {
     float left_channel[AUDIO_CHUNK_SAMPLES];
     float right_channel[AUDIO_CHUNK_SAMPLES];
 };
 
+/* Storage for the largest block the master chain can render at once */
+struct audio_block {
+    float left_channel[AUDIO_MAX_BLOCK_SAMPLES];
+    float right_channel[AUDIO_MAX_BLOCK_SAMPLES];
+};
+
+/* A view of consecutive stereo frames - a whole chunk or a part of a block */
+struct audio_span {
+    float* left_channel;
+    float* right_channel;
+    int frames;
+
+    audio_span(audio_chunk& chunk)
+        : left_channel(chunk.left_channel)
+        , right_channel(chunk.right_channel)
+        , frames(AUDIO_CHUNK_SAMPLES)
+    {
+    }
+
+    audio_span(audio_block& block, int frames)
+        : left_channel(block.left_channel)
+        , right_channel(block.right_channel)
+        , frames(frames)
+    {
+    }
+};
+
+struct chunk_stamp {
+    uint32_t position; // song sample of the first frame in a chunk
+    bool playing;
+};
+
 /**
  * \class 
- * \brief This class provides a thread-safe circular audio buffer 
+ * \brief This class provides a wait-free single-producer/single-consumer
+ *        circular audio buffer
+ * 
+ * The mixer thread is the only writer and the audio worklet is the only
+ * reader. The reader never locks nor spins, the writer parks on an atomic
+ * wait while the buffer is full. `clear()` may be called from any thread:
+ * it starts a new epoch and chunks written in an older one are dropped.
  * 
- * The buffer can be used by both worklet and worker threads simultaneously.
+ * Both sides work on the slots in place: the writer renders straight into
+ * a reserved slot and the reader gets a view of the oldest one.
+ * 
+ * The writer only fills the buffer up to the target size, which can be
+ * changed at runtime anywhere between one chunk and the full capacity.
  */
 class AudioBuffer {
 public:
     AudioBuffer(int sampleSize);
 
     int underflow_count() const;
-    bool operator>>(audio_chunk& target);
-    AudioBuffer& operator<<(const audio_chunk& source);
+    uint32_t epoch() const;
     void clear();
 
+    int capacity() const;
+    void set_target_size(int sampleSize);
+    int target_size() const;
+    int fill_level() const;
+
+    /* Writer side - must only be called from a single (mixer) thread */
+    audio_chunk* reserve_write();
+    void commit_write(const chunk_stamp& stamp);
+    /* Lowest fill (in chunks) the reader found since the last call, or NO_READS */
+    uint32_t take_low_read_fill();
+
+    static constexpr uint32_t NO_READS = UINT32_MAX;
+
+    /* Reader side - must only be called from a single (worklet) thread */
+    const audio_chunk* peek_read(chunk_stamp* stamp = nullptr);
+    void release_read();
+    void discard();
+
 private:
-    std::unique_ptr<audio_chunk[]> _chunk_array;
-    int _array_size;
+    struct slot {
+        audio_chunk chunk;
+        chunk_stamp stamp;
+        uint32_t epoch;
+    };
+
+    std::unique_ptr<slot[]> _slots;
+    uint32_t _array_size;
+    uint32_t _index_mask;
+
+    // Indices grow monotonically and wrap around at 2^32, slot number
+    // is obtained by masking them (array size is always a power of two)
+    alignas(64) std::atomic<uint32_t> _read_idx;
+    alignas(64) std::atomic<uint32_t> _write_idx;
+    alignas(64) std::atomic<uint32_t> _epoch;
     std::atomic_int _underflow_count;
-    std::atomic_int _read_idx;
-    std::atomic_int _write_idx;
-    std::atomic_int _reset_counter;
-    SpinLock _read_lock, _write_lock;
+    std::atomic<uint32_t> _target_chunks;
+    // Written by the reader only: its lowest fill in the low half, tagged
+    // with the sequence number it belongs to. Bumping the sequence number
+    // starts over, without the two sides ever contending.
+    std::atomic<uint64_t> _low_read_fill;
+    std::atomic<uint32_t> _read_fill_sequence;
+
+    uint32_t _reserved_epoch; // writer-owned
+
+    void record_read_fill(uint32_t chunks);
+
 };
@@ -1,10 +1,16 @@
 #pragma once
+#include <audible-clock.h>
+
 #include <emscripten/webaudio.h>
+
+#include <atomic>
 #include <memory>
 
 // Forward declarations
 struct audio_chunk;
 class AudioBuffer;
+class Mixer;
+class PerformanceMonitor;
 
 /**
  * \class
@@ -26,11 +32,34 @@ public:
         return _audio_buffer.get();
     }
 
+    void set_performance_monitor(std::shared_ptr<PerformanceMonitor> monitor)
+    {
+        _monitor = std::move(monitor);
+    }
+
+    const AudibleClock& audible_clock() const
+    {
+        return _clock;
+    }
+
+    /* Sample rate of the audio context, which may differ from the song's one */
+    int sample_rate() const;
+
+    /* The mixer is only used when it is switched to direct rendering mode */
+    void set_mixer(Mixer* mixer)
+    {
+        _mixer.store(mixer, std::memory_order_release);
+    }
+
 private:
     EMSCRIPTEN_WEBAUDIO_T _audio_context;
     std::shared_ptr<AudioBuffer> _audio_buffer;
+    std::shared_ptr<PerformanceMonitor> _monitor;
+    std::atomic<Mixer*> _mixer = nullptr; // set while the audio thread may be running
+    AudibleClock _clock;
 
     void process_audio(audio_chunk* output_buffer);
+    double context_time() const;
 
     static void callback_audio_thread_initialized(
         EMSCRIPTEN_WEBAUDIO_T audio_context, EM_BOOL success, void *user_data);
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * \class
+ * \brief Storage of named binary blobs that outlives the session, used by
+ *        the stem cache
+ *
+ * Implementations must be safe to call from any thread, but the cache never
+ * calls them concurrently.
+ */
+class CacheBackend {
+public:
+    struct blob {
+        std::string name;
+        uint64_t bytes;
+    };
+
+    virtual ~CacheBackend() = default;
+
+    virtual std::vector<blob> list() = 0;
+    /* Returns false if there's no such blob or it can't be read */
+    virtual bool read(const std::string& name, std::vector<uint8_t>& data) = 0;
+    /* Replaces the blob at once, a failed write leaves no part of it behind */
+    virtual bool write(const std::string& name, const uint8_t* data, size_t bytes) = 0;
+    virtual void remove(const std::string& name) = 0;
+    /* Makes the changes so far survive reloading the page */
+    virtual void flush() {}
+};
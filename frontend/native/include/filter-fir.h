@@ -2,6 +2,10 @@
 #include <array>
 #include <functional>
 
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+
 /**
  * \class
  * 
@@ -57,3 +61,71 @@ private:
     }
 
 };
+
+/**
+ * \class
+ * 
+ * \brief A template class that implements one channel of a polyphase FIR
+ *        filter, where the coefficient set is chosen for every output sample
+ * 
+ * The history is kept twice in a row, so that the last `taps` samples are
+ * always contiguous in memory and can be convolved with vector instructions.
+ * Coefficient sets passed to `operator()` must be ordered from the oldest
+ * sample to the newest one.
+ * 
+ * \tparam taps number of taps of a single phase (must be a multiple of 4)
+ */
+template <unsigned long taps>
+class PolyphaseFIRFilter {
+public:
+    static_assert(taps % 4 == 0, "taps must be a multiple of 4");
+
+    PolyphaseFIRFilter()
+        : _history_index(0)
+    {
+        _history.fill(0.f);
+    }
+
+    void push(float in_sample)
+    {
+        _history[_history_index] = in_sample;
+        _history[_history_index + taps] = in_sample;
+
+        if (++_history_index >= taps) {
+            _history_index = 0;
+        }
+    }
+
+    float operator()(const float* coefficients) const
+    {
+        const float* window = &_history[_history_index];
+
+#ifdef __wasm_simd128__
+        v128_t sum = wasm_f32x4_splat(0.f);
+        for (unsigned long i = 0; i < taps; i += 4) {
+            sum = wasm_f32x4_add(sum, wasm_f32x4_mul(
+                wasm_v128_load(window + i), wasm_v128_load(coefficients + i)));
+        }
+
+        return wasm_f32x4_extract_lane(sum, 0) + wasm_f32x4_extract_lane(sum, 1)
+             + wasm_f32x4_extract_lane(sum, 2) + wasm_f32x4_extract_lane(sum, 3);
+#else
+        float sum = 0.f;
+        for (unsigned long i = 0; i < taps; ++i) {
+            sum += window[i] * coefficients[i];
+        }
+
+        return sum;
+#endif
+    }
+
+    void reset()
+    {
+        _history.fill(0.f);
+        _history_index = 0;
+    }
+
+private:
+    std::array<float, 2 * taps> _history;
+    unsigned long _history_index;
+};
@@ -0,0 +1,46 @@
+#pragma once
+#include <stem-storage.h>
+#include <stream-decoder.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * \class
+ * \brief Decodes a native FLAC stream that arrives in arbitrary pieces,
+ *        appending the audio to a stem storage frame after frame
+ *
+ * FLAC frames don't depend on each other and start with a sync code, so a
+ * complete file can be split anywhere and the parts decoded in parallel by
+ * `decode_range()`. The CRC of every frame is checked.
+ *
+ * Streams of up to 24 bits are supported. Samples are truncated to 16 bits,
+ * mono is played on both channels and only the first two channels of
+ * multichannel streams are kept.
+ */
+class FlacStreamDecoder : public StreamDecoder {
+public:
+    explicit FlacStreamDecoder(StemStorage::Writer& writer);
+    ~FlacStreamDecoder();
+
+    bool feed(const uint8_t* data, size_t bytes) override;
+    bool finish() override;
+
+    /* A `StreamDecoder::RangeDecoder` */
+    static bool decode_range(const uint8_t* data, size_t bytes, StemStorage::Writer& writer,
+        const std::atomic_bool& cancelled);
+
+private:
+    class BitReader;
+    class FrameDecoder;
+
+    static const size_t BISECT_MIN_BYTES;
+    static const uint32_t OUTPUT_BUFFER_FRAMES;
+
+    StemStorage::Writer& _writer;
+    std::unique_ptr<FrameDecoder> _decoder; // created once the headers are complete
+    std::vector<uint8_t> _pending;
+};
@@ -0,0 +1,34 @@
+#pragma once
+#include <cache-backend.h>
+
+#include <string>
+
+/**
+ * \class
+ * \brief Keeps cached blobs as files of a directory in the Emscripten file
+ *        system, one file per blob
+ *
+ * In the browser the directory is an IDBFS mount, already populated from
+ * IndexedDB. Flushing writes the changes back there a moment later, so that
+ * a burst of them (like a whole song being stored) is synced only once.
+ * Over MEMFS or NODEFS (e.g. in tests) flushing isn't needed.
+ */
+class FsCacheBackend : public CacheBackend {
+public:
+    FsCacheBackend(std::string directory, bool sync_idbfs);
+
+    std::vector<blob> list() override;
+    bool read(const std::string& name, std::vector<uint8_t>& data) override;
+    bool write(const std::string& name, const uint8_t* data, size_t bytes) override;
+    void remove(const std::string& name) override;
+    void flush() override;
+
+private:
+    static const char* TEMP_SUFFIX;
+    static const int SYNC_DELAY_MS;
+
+    std::string _directory;
+    bool _sync_idbfs;
+
+    std::string path_of(const std::string& name) const;
+};
@@ -0,0 +1,57 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Forward declarations
+class AudioBuffer;
+
+/**
+ * \class
+ * \brief This class adapts the target size of the output buffer to what
+ *        the current machine can sustain
+ * 
+ * It must be fed from the mixer thread once per written chunk. The buffer
+ * grows as soon as an underflow happens and shrinks slowly when the fill
+ * level histogram shows that there is plenty of headroom left. Fill levels
+ * are the ones the reader finds, the writer itself always sees the buffer
+ * just below its target. A size that underflowed isn't tried again until
+ * the buffer has been stable for a while, twice as long after every retry
+ * that failed.
+ */
+class LatencyController {
+public:
+    LatencyController(AudioBuffer& buffer);
+
+    void set_bounds(uint32_t min_samples, uint32_t max_samples);
+    uint32_t min_latency_samples() const;
+    uint32_t max_latency_samples() const;
+    uint32_t target_latency_samples() const;
+
+    void process();
+
+private:
+    static const int WINDOW_CHUNKS;
+    static const int HEADROOM_CHUNKS;
+    static const int STABLE_WINDOWS_TO_SHRINK;
+    static const int STABLE_WINDOWS_TO_LOWER_FLOOR;
+    static const int MAX_WINDOWS_TO_LOWER_FLOOR;
+    static const double LOW_PERCENTILE;
+
+    AudioBuffer& _buffer;
+    std::atomic<uint32_t> _min_chunks;
+    std::atomic<uint32_t> _max_chunks;
+
+    std::vector<uint32_t> _fill_histogram;
+    int _window_position;
+    int _stable_windows;
+    int _floor_windows;
+    int _floor_hold_windows;
+    uint32_t _floor_chunks; // the largest size that underflowed lately
+    int _last_underflows;
+    uint32_t _last_epoch;
+
+    void evaluate_window();
+    uint32_t low_fill_percentile() const;
+    void set_target_chunks(uint32_t chunks);
+};
@@ -2,7 +2,7 @@
 #include <atomic>
 
 // Forward declarations
-struct audio_chunk;
+struct audio_span;
 
 class Limiter {
 public:
@@ -20,7 +20,7 @@ public:
     double threshold_db() const;
     double reduction_db() const;
 
-    void apply(audio_chunk& chunk);
+    void apply(const audio_span& block);
 
 private:
     struct limiter_settings {
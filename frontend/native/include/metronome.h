@@ -2,7 +2,7 @@
 #include <stdint.h>
 
 // Forward declarations
-struct audio_chunk;
+struct audio_span;
 class Tempo;
 
 class Metronome {
@@ -12,8 +12,8 @@ public:
     void set_gain(double gain);
     double gain() const;
 
-    void process(uint32_t first_sample);
-    void render(audio_chunk& chunk);
+    void process(uint32_t first_sample, int frames);
+    void render(const audio_span& block);
 
 private:
     static const uint8_t SOUND_BAR[];
@@ -0,0 +1,46 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * \class
+ * \brief Inner loops of stem mixing. They are compiled with WebAssembly
+ *        SIMD when it's available and fall back to scalar code otherwise.
+ * 
+ * Every kernel converts `frames` interleaved stereo int16 frames to float,
+ * scales them by the channel gains and adds them to the output channels.
+ * The range must be fully within the source data - there are no bounds
+ * checks. Specialized kernels for common stem configurations are picked
+ * with `select()` whenever stem parameters change.
+ */
+class MixKernels {
+public:
+    using Kernel = void (*)(const int16_t* source, int frames,
+        float gain_l, float gain_r, float* left, float* right);
+
+    /* Gain of a stem at 0 dB and centre pan, int16 to float conversion included */
+    static constexpr float UNITY_GAIN = 1 / 32768.f;
+
+    /* 
+     * Returns the cheapest kernel for the given configuration, or nullptr
+     * if the stem is silent. `mono` means that both channels of the source
+     * are identical.
+     */
+    static Kernel select(bool mono, float gain_l, float gain_r);
+
+    static void accumulate_stereo(const int16_t* source, int frames,
+        float gain_l, float gain_r, float* left, float* right);
+
+    /* Name of the variant that has been compiled in */
+    static const char* variant();
+
+private:
+    enum class GainMode {
+        UNITY,      // both gains equal to UNITY_GAIN
+        CENTERED,   // both gains equal
+        GENERIC,
+    };
+
+    template <bool mono, GainMode mode>
+    static void accumulate(const int16_t* source, int frames,
+        float gain_l, float gain_r, float* left, float* right);
+};
@@ -1,4 +1,6 @@
 #pragma once
+#include <audio-buffer.h>
+#include <performance-monitor.h>
 #include <spin-lock.h>
 #include <stem-manager.h>
 #include <tempo.h>
@@ -7,13 +9,12 @@
 #include <thread>
 
 // Forward declarations
-class AudioBuffer;
+class LatencyController;
 class Limiter;
 class Metronome;
+class OutputStage;
 class PeakMeter;
-
-struct audio_chunk;
-
+class Resampler;
 
 /**
  * \class
@@ -22,7 +23,10 @@ struct audio_chunk;
  */
 class Mixer {
 public:
-    Mixer(std::shared_ptr<AudioBuffer> out_buffer);
+    Mixer(
+        std::shared_ptr<AudioBuffer> out_buffer, 
+        std::shared_ptr<PerformanceMonitor> monitor, 
+        int output_sample_rate);
     ~Mixer();
 
     int test_js_binding() const;
@@ -35,10 +39,12 @@ public:
     void reset_playback();
     uint32_t playback_position() const;
     song_position playback_position_bst() const;
+    song_position song_position_at(uint32_t sample) const;
     bool set_playback_position(uint32_t new_position);
     uint32_t bar_sample(uint32_t bar) const;
 
     int sample_rate() const;
+    int output_sample_rate() const;
 
     void set_metronome_enabled(bool enabled);
     void toggle_metronome();
@@ -68,7 +74,33 @@ public:
     bool stem_muted(uint32_t stem_id) const;
     bool stem_soloed(uint32_t stem_id) const;
 
+    void set_lazy_decoding(bool enabled);
+    bool lazy_decoding() const;
+    void set_pcm_cache_size_mb(int megabytes);
+    int pcm_cache_size_mb() const;
+    void set_stem_cache(std::shared_ptr<StemCache> files, std::shared_ptr<StemCache> decoded);
+    void set_stem_cache_size_mb(int megabytes);
+    int stem_cache_size_mb() const;
+    void set_decoded_stem_cache_size_mb(int megabytes);
+    int decoded_stem_cache_size_mb() const;
+    void set_retained_stems_size_mb(int megabytes);
+    int retained_stems_size_mb() const;
+
     double limiter_reduction_db() const;
+    void set_output_trim_db(double trim_db);
+    double output_trim_db() const;
+
+    void set_render_block_size(int frames);
+    int render_block_size() const;
+
+    void set_output_latency_bounds(uint32_t min_samples, uint32_t max_samples);
+    uint32_t output_latency() const;
+
+    performance_stats collect_performance_stats() const;
+
+    void set_direct_rendering(bool enabled);
+    bool direct_rendering() const;
+    chunk_stamp render_direct(audio_chunk& chunk);
 
 private:
     enum class PlaybackState {
@@ -79,11 +111,13 @@ private:
 
     std::thread _thread;
     std::shared_ptr<AudioBuffer> _buffer;
+    std::shared_ptr<PerformanceMonitor> _monitor;
     std::atomic<PlaybackState> _state;
     PlaybackState _last_state;
     std::atomic<uint32_t> _playback_position;
     uint32_t _last_playback_position;
     std::atomic<uint32_t> _length;
+    std::atomic_bool _direct_rendering;
 
     std::unique_ptr<Tempo> _tempo;
     std::unique_ptr<PeakMeter> _master_level;
@@ -92,14 +126,31 @@ private:
     std::atomic<double> _metronome_gain_db;
     
     std::unique_ptr<Limiter> _limiter;
+    std::unique_ptr<OutputStage> _output_stage;
+    std::unique_ptr<LatencyController> _latency;
+
+    std::unique_ptr<Resampler> _resampler;
+    // The master bus is rendered in blocks and sliced into output chunks
+    std::atomic<int> _render_block_size;
+    std::unique_ptr<audio_block> _master_block;
+    int _master_frames;
+    int _master_read;
+    chunk_stamp _master_stamp;
 
     SpinLock _mixdown_lock;
 
     StemManager _stems;
 
     void thread_main();
-    void perform_mixdown(audio_chunk& chunk);
-    void apply_soft_start(audio_chunk& chunk);
-    void apply_soft_stop(audio_chunk& chunk);
+    chunk_stamp perform_mixdown(audio_chunk& chunk);
+    chunk_stamp render_locked(audio_chunk& chunk);
+    chunk_stamp slice_locked(audio_chunk& chunk);
+    chunk_stamp resample_locked(audio_chunk& chunk);
+    int render_block_frames() const;
+    void mixdown_master_locked();
+    chunk_stamp mixdown_locked(const audio_span& block);
+    void reset_render_state();
+    void apply_soft_start(const audio_span& block);
+    void apply_soft_stop(const audio_span& block);
     void invalidate_state();
 };
@@ -0,0 +1,29 @@
+#pragma once
+#include <atomic>
+
+// Forward declarations
+struct audio_chunk;
+
+/**
+ * \class
+ * \brief The last stage of the master chain - hard-clips the signal to the
+ *        [-1, 1] range and applies output trim
+ *
+ * Trim comes after the clipper, so that peaks stay below full scale.
+ */
+class OutputStage {
+public:
+    OutputStage();
+
+    void set_trim_db(double trim_db);
+    double trim_db() const;
+
+    void apply(audio_chunk& chunk);
+
+private:
+    static const double DEFAULT_TRIM_DB;
+
+    std::atomic<double> _trim_db;
+    std::atomic<float> _trim_gain; // linear, follows _trim_db
+    float _current_gain;
+};
@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+// Forward declarations
+class StemStorage;
+
+/**
+ * \class
+ * \brief A size-bounded cache of decoded PCM blocks, shared by all lazily
+ *        decoded stems. The least recently used block is evicted first.
+ * 
+ * Blocks are mapped into the segment table of their stem storage, so that
+ * the mixer reads them without locking. The memory of an evicted block is
+ * only freed once the reader counter shows that no render which might have
+ * seen it is still in progress (the same scheme as for render lists).
+ */
+class PcmBlockCache {
+public:
+    static constexpr uint32_t BLOCK_FRAMES = 32 * 1024; // 128 kB of stereo int16
+
+    PcmBlockCache(size_t capacity_bytes, const std::atomic<uint32_t>& reader_epoch);
+    ~PcmBlockCache();
+
+    void set_capacity(size_t bytes);
+    size_t capacity() const;
+    size_t used_bytes() const;
+
+    /* Blocks are stamped with this clock when used, it advances once per render */
+    uint32_t now() const;
+    void tick();
+
+    /* Replaces the block if it's already cached */
+    void insert(StemStorage& owner, uint32_t block, const int16_t* samples, uint32_t frames);
+    /* Copies part of a cached block, returns false if it's not cached */
+    bool read(StemStorage& owner, uint32_t block, uint32_t offset, uint32_t frames,
+        int16_t* output);
+    bool resident(const StemStorage& owner, uint32_t block) const;
+    /* Drops all blocks of a storage */
+    void release(StemStorage& owner);
+
+private:
+    struct entry {
+        StemStorage* owner;
+        uint32_t block;
+        std::unique_ptr<int16_t[]> samples;
+    };
+
+    struct retired_block {
+        std::unique_ptr<int16_t[]> samples;
+        uint32_t reader_epoch; // reader counter when the block was unmapped
+    };
+
+    mutable std::mutex _mutex;
+    std::vector<entry> _entries;
+    std::vector<retired_block> _retired;
+    size_t _capacity_blocks;
+    const std::atomic<uint32_t>& _reader_epoch;
+    std::atomic<uint32_t> _clock;
+
+    size_t least_recently_used_locked() const;
+    void evict_locked(size_t index);
+    void reclaim_locked();
+};
@@ -2,7 +2,7 @@
 #include <memory>
 
 // Forward declarations
-struct audio_chunk;
+struct audio_span;
 
 class PeakMeter {
 public:
@@ -11,7 +11,7 @@ public:
 
     double left_db() const;
     double right_db() const;
-    void process(const audio_chunk& chunk);
+    void process(const audio_span& block);
     void reset();
 
 private:
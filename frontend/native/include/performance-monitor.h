@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+struct performance_stats {
+    double mixdown_bucket_ms;
+    std::vector<uint32_t> mixdown_histogram;
+    double mixdown_mean_ms;
+    double mixdown_max_ms;
+    uint32_t fill_bucket_samples;
+    std::vector<uint32_t> fill_histogram;
+    double worst_jitter_ms;
+    uint32_t underflow_count;
+    std::vector<double> underflow_timestamps_ms;
+    uint32_t output_latency;
+    std::vector<uint32_t> task_queue_depths; // background tasks, per priority
+    uint32_t task_queue_peak;
+    uint32_t tasks_running;
+    uint32_t tasks_completed;
+    uint32_t tasks_cancelled;
+    uint32_t tasks_coalesced;
+};
+
+/**
+ * \class
+ * \brief This class collects timing statistics of the audio threads
+ * 
+ * Each group of counters has exactly one writer (mixdown timings - the
+ * mixer thread, buffer reads - the audio worklet), so everything is
+ * recorded with relaxed atomic stores, without any locking. A snapshot
+ * can be taken from any thread.
+ */
+class PerformanceMonitor {
+public:
+    PerformanceMonitor(int buffer_capacity, int sample_rate);
+
+    void record_mixdown(double duration_ms);
+    void record_read(int fill_level, double timestamp_ms);
+    void record_underflow(double timestamp_ms);
+
+    performance_stats snapshot() const;
+
+private:
+    static const double MIXDOWN_BUCKET_MS;
+    static const int MIXDOWN_BUCKETS;
+    static const int UNDERFLOW_EVENTS;
+    static const double MAX_READ_INTERVAL_MS;
+
+    using Counter = std::atomic<uint32_t>;
+
+    std::unique_ptr<Counter[]> _mixdown_histogram;
+    std::atomic<double> _mixdown_total_ms;
+    std::atomic<double> _mixdown_max_ms;
+    Counter _mixdown_count;
+
+    int _fill_buckets;
+    std::unique_ptr<Counter[]> _fill_histogram;
+    std::atomic<double> _worst_jitter_ms;
+    double _quantum_ms;
+    double _last_read_ms; // worklet-owned
+
+    std::unique_ptr<std::atomic<double>[]> _underflow_events;
+    Counter _underflow_count;
+
+    static void increment(Counter& counter);
+};
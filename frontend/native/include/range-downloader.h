@@ -0,0 +1,104 @@
+#pragma once
+#include <task-pool.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * \class
+ * \brief Downloads a file piece by piece with HTTP range requests, so that
+ *        its beginning can be processed while the rest is still in flight
+ *
+ * Requests are synchronous, so it must not be used on the main thread. Once
+ * the first range tells the size of the file, up to `connections` ranges are
+ * fetched at once: by the thread calling `next()` and by helper threads
+ * borrowed from the task pool, as many as are free. Chunks are still returned
+ * in order, as soon as all of the preceding ones have arrived.
+ *
+ * All downloaders together keep at most `MAX_REQUESTS_IN_FLIGHT` requests
+ * in flight, as the stems come from one host. Each range is retried
+ * separately, with exponential backoff. If the server ignores the `Range`
+ * header, the whole file arrives as a single chunk.
+ *
+ * The size is read from `Content-Range`, which cross-origin servers have to
+ * list in `Access-Control-Expose-Headers`. Otherwise it's probed with a HEAD
+ * request, and without a `Content-Length` either, ranges are fetched one by
+ * one until the end.
+ */
+class RangeDownloader {
+public:
+    /* Polled between requests, returns true if the download should stop */
+    using CancelCheck = std::function<bool()>;
+
+    static const int MAX_REQUESTS_IN_FLIGHT;
+
+    RangeDownloader(std::string url, uint32_t chunk_bytes, int connections, int retry_count,
+        CancelCheck cancelled, TaskPool& pool);
+    /* Waits for the requests of the helpers that are in flight */
+    ~RangeDownloader();
+
+    /* Blocks until the next chunk arrives, returns false when there's none */
+    bool next(std::vector<uint8_t>& chunk);
+
+    bool failed() const;
+    uint64_t downloaded_bytes() const;
+    uint64_t total_bytes() const; // 0 until known
+
+private:
+    enum class FetchStatus {
+        OK,
+        PAST_END, // range not satisfiable
+        FAILED,
+        CANCELLED,
+    };
+
+    struct fetched_range {
+        std::vector<uint8_t> data;
+        uint64_t total; // from the `Content-Range` header, 0 if unknown
+        bool partial;   // false if the server sent the whole file instead
+    };
+
+    static const int RETRY_BASE_DELAY_MS;
+    static const int RETRY_MAX_DELAY_MS;
+    static const int CANCEL_POLL_MS;
+    static const int RANGES_AHEAD_PER_CONNECTION;
+
+    std::string _url;
+    uint32_t _chunk_bytes;
+    int _connections;
+    int _retry_count;
+    CancelCheck _cancelled;
+    TaskPool& _pool;
+    uint64_t _offset;
+    uint64_t _total;
+    bool _finished;
+    bool _failed;
+
+    // Parallel ranges of the rest of the file, numbered from `_ranges_offset`
+    std::mutex _mutex;
+    std::condition_variable _range_done;
+    std::vector<TaskPool::HelperJob> _helpers;
+    std::map<uint64_t, std::vector<uint8_t>> _fetched; // arrived out of order
+    uint64_t _ranges_offset;
+    uint64_t _ranges;        // 0 while fetching sequentially
+    uint64_t _next_claimed;
+    uint64_t _next_returned;
+    FetchStatus _ranges_status;
+    bool _stop;
+
+    FetchStatus fetch_range(uint64_t first, uint64_t last, fetched_range& range);
+    uint64_t probe_total_size();
+    bool acquire_request_slot();
+    bool wait_before_retry(int approach);
+
+    bool next_sequential(std::vector<uint8_t>& chunk);
+    bool next_parallel(std::vector<uint8_t>& chunk);
+    void start_parallel();
+    bool fetch_claimed_locked(std::unique_lock<std::mutex>& lock);
+    void helper_main();
+};
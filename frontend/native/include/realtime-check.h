@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+
+/**
+ * \class
+ * \brief Debug helper that flags operations which are not realtime-safe
+ * 
+ * While a thread is inside a `RealtimeCheck::Scope`, every heap allocation,
+ * deallocation, mutex lock or blocking spin lock made by that thread is
+ * reported to the console together with a stack trace. The checks are only
+ * compiled in when `GS_REALTIME_CHECKS` is defined (debug builds), otherwise
+ * everything here is a no-op.
+ */
+class RealtimeCheck {
+public:
+    class Scope {
+    public:
+        Scope() { RealtimeCheck::enter(); }
+        ~Scope() { RealtimeCheck::leave(); }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+#ifdef GS_REALTIME_CHECKS
+    static void enter();
+    static void leave();
+    static bool active();
+    static void report(const char* operation);
+    static uint32_t violation_count();
+#else
+    static void enter() {}
+    static void leave() {}
+    static bool active() { return false; }
+    static void report(const char*) {}
+    static uint32_t violation_count() { return 0; }
+#endif
+};
@@ -0,0 +1,36 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+/**
+ * \class
+ * \brief A fixed pool of threads that run one job in parallel, split into
+ *        partitions. It is meant to be driven by a single thread at a time.
+ * 
+ * The calling thread always runs partition 0 itself and waits for the
+ * workers to finish the remaining ones. Workers sleep on an atomic between
+ * runs, so starting a run doesn't allocate nor take any locks.
+ */
+class RenderPool {
+public:
+    /* The job is called with a partition index from any of the pool threads */
+    using Job = std::function<void(int partition)>;
+
+    RenderPool(int workers, Job job);
+    ~RenderPool();
+
+    int max_partitions() const;
+    void run(int partitions);
+
+private:
+    Job _job;
+    std::vector<std::thread> _threads;
+    std::atomic<uint32_t> _generation;
+    std::atomic<int> _partitions;
+    std::atomic<int> _pending;
+    std::atomic_bool _quit;
+
+    void thread_main(int partition);
+};
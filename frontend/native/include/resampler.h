@@ -0,0 +1,57 @@
+#pragma once
+#include <filter-fir.h>
+
+#include <cstdint>
+#include <vector>
+
+// Forward declarations
+struct audio_chunk;
+struct audio_span;
+
+/**
+ * \class
+ * \brief This class converts the stereo master bus to the output sample rate
+ * 
+ * It is a rational L/M polyphase resampler: input blocks are fed one by one
+ * with `feed()` and `process()` fills output chunks for as long as there is
+ * enough input. When both sample rates are equal, the resampler is bypassed
+ * and shouldn't be used at all.
+ */
+class Resampler {
+public:
+    Resampler(int input_rate, int output_rate);
+
+    bool bypass() const;
+    int input_rate() const;
+    int output_rate() const;
+
+    bool needs_input() const;
+    int input_offset() const;
+    void feed(const audio_span& input);
+    int process(audio_chunk& output, int first_frame);
+    void reset();
+
+private:
+    static const int TAPS = 64;
+    static const int MAX_PHASES = 512;
+    static const double KAISER_BETA;
+    static const double CUTOFF_RATIO;
+
+    using FilterType = PolyphaseFIRFilter<TAPS>;
+
+    int _input_rate, _output_rate;
+    int _phases;      // L - interpolation factor
+    int _decimation;  // M - decimation factor
+    std::vector<float> _coeffs; // _phases sets of TAPS coefficients
+
+    FilterType _left_filter, _right_filter;
+    const float* _input_left;  // the fed block must stay valid
+    const float* _input_right; // until all of it is consumed
+    int _input_position;
+    int _input_frames;
+    int _phase;
+    int _pending_inputs;
+
+    void find_ratio();
+    void design_filter();
+};
@@ -0,0 +1,76 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * \class
+ * \brief A sequence lock holding a small, trivially copyable value
+ * 
+ * There must be only one writer at a time. Readers never block it, they
+ * retry instead if a write was in progress while they were copying.
+ * 
+ * \tparam T type of the value, its size must be a multiple of 4 bytes
+ */
+template <typename T>
+class SeqLock {
+public:
+    static_assert(std::is_trivially_copyable_v<T>, "T must be trivially copyable");
+    static_assert(sizeof(T) % sizeof(uint32_t) == 0, "T size must be a multiple of 4");
+
+    explicit SeqLock(const T& value = T())
+        : _sequence(0)
+    {
+        std::array<uint32_t, WORDS> words;
+        memcpy(words.data(), &value, sizeof(T));
+
+        for (size_t i = 0; i < WORDS; ++i) {
+            _words[i].store(words[i], std::memory_order_relaxed);
+        }
+    }
+
+    void store(const T& value)
+    {
+        std::array<uint32_t, WORDS> words;
+        memcpy(words.data(), &value, sizeof(T));
+
+        uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+        _sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (size_t i = 0; i < WORDS; ++i) {
+            _words[i].store(words[i], std::memory_order_relaxed);
+        }
+
+        _sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    T load() const
+    {
+        std::array<uint32_t, WORDS> words;
+        uint32_t sequence_before, sequence_after;
+
+        do {
+            sequence_before = _sequence.load(std::memory_order_acquire);
+
+            for (size_t i = 0; i < WORDS; ++i) {
+                words[i] = _words[i].load(std::memory_order_relaxed);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            sequence_after = _sequence.load(std::memory_order_relaxed);
+        } while (sequence_before != sequence_after || (sequence_before & 1));
+
+        T value;
+        memcpy(&value, words.data(), sizeof(T));
+        return value;
+    }
+
+private:
+    static constexpr size_t WORDS = sizeof(T) / sizeof(uint32_t);
+
+    std::atomic<uint32_t> _sequence;
+    std::array<std::atomic<uint32_t>, WORDS> _words;
+};
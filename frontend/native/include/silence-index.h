@@ -0,0 +1,42 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+/**
+ * \class
+ * \brief Marks blocks of a decoded stem that contain nothing but silence,
+ *        so that mixing can skip them
+ * 
+ * The index is built once, block by block while a stem is being stored, in
+ * any order but by one writer at a time. It may be read concurrently with
+ * that, as long as the reader only asks about blocks whose storing has been
+ * published to it by other means. By default
+ * only digital silence counts, which makes skipping blocks inaudible.
+ */
+class SilenceIndex {
+public:
+    static const uint32_t BLOCK_FRAMES;
+    static const int16_t DIGITAL_SILENCE_THRESHOLD;
+
+    /* Also used by waveform rendering, with a threshold of its own */
+    static bool is_silent(int16_t left, int16_t right, int16_t threshold)
+    {
+        return (left < 0 ? -left : left) < threshold 
+            && (right < 0 ? -right : right) < threshold;
+    }
+
+    /* Sizes the index for `blocks` blocks, all of them not silent */
+    void reset(uint32_t blocks);
+    /* Stores each block once, only the last one may be shorter than BLOCK_FRAMES */
+    bool store_block(uint32_t block, const int16_t* samples, uint32_t frames, 
+        int16_t threshold = DIGITAL_SILENCE_THRESHOLD);
+    bool silent(uint32_t first_frame, uint32_t frames) const;
+    uint32_t silent_blocks() const;
+    uint32_t total_blocks() const;
+
+private:
+    std::unique_ptr<std::atomic<uint64_t>[]> _silent_bits; // one bit per block
+    uint32_t _total_blocks = 0;
+    uint32_t _silent_blocks = 0; // writer side only
+};
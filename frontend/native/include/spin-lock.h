@@ -1,4 +1,6 @@
 #pragma once
+#include <realtime-check.h>
+
 #include <atomic>
 
 class SpinLock
@@ -13,6 +15,7 @@ public:
 
     void lock()
     {
+        RealtimeCheck::report("Spin lock");
         while(_lock_flag.test_and_set(std::memory_order_acquire)) { }
     }
 
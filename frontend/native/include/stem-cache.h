@@ -0,0 +1,80 @@
+#pragma once
+#include <cache-backend.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * \class
+ * \brief A size-bounded cache of stem data that persists between sessions.
+ *        The least recently used file is evicted first.
+ *
+ * Stem files never change once they're ready, so whatever is derived from
+ * them is looked up by their URL alone, without asking the server.
+ * Compressed files and decoded audio are kept by separate caches, each
+ * with a budget of its own.
+ *
+ * The LRU order and the key of every file are kept in an index blob, written
+ * after the files themselves. Files missing from the index, e.g. because the
+ * page was closed in between, are removed when the cache is opened. Loading
+ * only reorders the index in memory, it's written with the next change or
+ * once `INDEX_SAVE_INTERVAL_MS` have passed, so a lost update just makes the
+ * eviction order a bit stale.
+ *
+ * File system calls of worker threads wait for the main thread, which must
+ * therefore never wait for the cache's lock: only the constructor and the
+ * lock-free methods may be called there.
+ */
+class StemCache {
+public:
+    StemCache(std::unique_ptr<CacheBackend> backend, uint64_t capacity_bytes);
+    ~StemCache();
+
+    /* Returns false if the file isn't cached */
+    bool load(const std::string& key, std::vector<uint8_t>& data);
+    /* 
+     * Evicts the least recently used files to make room. With `spare_session`
+     * set, it gives up instead of evicting files used in this session (e.g.
+     * the other stems of the same song). Returns false if nothing was stored.
+     */
+    bool store(const std::string& key, const std::vector<uint8_t>& data,
+        bool spare_session = false);
+    void remove(const std::string& key);
+
+    /* Lock-free, files are evicted when the next one is stored */
+    void set_capacity(uint64_t bytes);
+    uint64_t capacity() const;
+    uint64_t used_bytes() const;
+
+private:
+    struct entry {
+        std::string name;
+        std::string key;
+        uint64_t bytes;
+        bool used_in_session = false;
+    };
+
+    static const char* INDEX_NAME;
+    static const int INDEX_SAVE_INTERVAL_MS;
+
+    mutable std::mutex _mutex;
+    std::unique_ptr<CacheBackend> _backend;
+    std::vector<entry> _entries; // from the least recently used one
+    std::atomic<uint64_t> _capacity;
+    std::atomic<uint64_t> _used;
+    bool _index_dirty; // reordered since it was last saved
+    std::chrono::steady_clock::time_point _index_saved_at;
+
+    static std::string blob_name(const std::string& key);
+
+    void open_locked();
+    bool evict_locked(uint64_t reserved_bytes, bool spare_session = false);
+    void erase_locked(size_t index);
+    void save_index_locked();
+    void save_index_if_due_locked();
+};
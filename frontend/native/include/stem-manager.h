@@ -1,9 +1,21 @@
 #pragma once
+#include <mix-kernels.h>
+#include <pcm-block-cache.h>
+#include <render-pool.h>
+#include <seqlock.h>
+#include <stem-cache.h>
+#include <stem-storage.h>
+#include <stream-decoder.h>
+#include <task-pool.h>
+
 #include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -11,12 +23,14 @@
 
 
 // Forward declarations
-struct audio_chunk;
+struct audio_block;
+struct audio_span;
 
 
 struct stem_info {
     uint32_t id;
     std::string path;
+    std::string format; // "flac", otherwise Ogg Vorbis
     uint32_t samples;
     int32_t offset;
     double gain_db;
@@ -32,6 +46,7 @@ struct stem_info {
 class StemManager {
 public:
     StemManager();
+    ~StemManager();
 
     void set_track_length(uint32_t samples);
     uint32_t track_length() const;
@@ -51,54 +66,206 @@ public:
     /* Bear in mind that the callback will be called from the worker thread! */
     void set_bg_task_complete_callback(std::function<void()> callback);
 
-    void render(uint32_t first_sample, audio_chunk& chunk);
+    /* 
+     * Stems are mixed on the render pool if `parallel` is set and there are
+     * enough of them. Never set it when calling from the audio worklet.
+     */
+    void render(uint32_t first_sample, const audio_span& block, bool parallel = true);
     void update_stem_info(const std::vector<stem_info>& info);
+    /* Seeking, stems that will be heard from there on are loaded first */
+    void set_playhead(uint32_t sample);
+
+    /* 
+     * Lazy stems keep only their compressed data and decode blocks of it on
+     * demand, ahead of the playhead. Applies to stems added afterwards.
+     */
+    void set_lazy_decoding(bool enabled);
+    bool lazy_decoding() const;
+    void set_pcm_cache_size(size_t bytes);
+    size_t pcm_cache_size() const;
+
+    /* 
+     * Stem files are kept in the first cache for later sessions. Decoded
+     * audio of stems that aren't lazy goes to the second one, as far as its
+     * budget goes. Applies to stems added afterwards.
+     */
+    void set_stem_cache(std::shared_ptr<StemCache> files, std::shared_ptr<StemCache> decoded);
+    void set_stem_cache_size(uint64_t bytes);
+    uint64_t stem_cache_size() const; // 0 without a cache
+    void set_decoded_stem_cache_size(uint64_t bytes);
+    uint64_t decoded_stem_cache_size() const;
+
+    /*
+     * Decoded stems of songs that are closed are kept up to this size, so
+     * that switching back to a song doesn't download or decode anything.
+     * They're dropped earlier if new stems need the memory.
+     */
+    void set_retained_stems_size(size_t bytes);
+    size_t retained_stems_size() const;
+
+    task_pool_stats task_stats() const;
 private:
+    /* Everything the mixer needs to know about a stem, precomputed */
+    struct stem_params {
+        float gain_l; // linear gains with the pan law and 
+        float gain_r; // int16 to float conversion applied
+        int32_t offset;
+        uint32_t samples;
+        MixKernels::Kernel kernel; // nullptr if the stem is silent
+    };
+
     struct StemEntry {
         stem_info info;
+        SeqLock<stem_params> params; // <-- read by the mixer, don't use `info` there
         std::mutex mutex;
-        std::atomic_bool data_ready;
+        std::atomic_bool data_ready; // fully decoded
         std::atomic_bool deleted;
         std::atomic_bool error;
+        std::atomic_bool mono; // both channels are identical
+        std::atomic_bool audible; // not muted, for ranking without `_mutex`
 
-        // do not use this string, it only owns 
-        // a binary data block, use `.data` instead
-        std::string data_block; 
-        
-        const int16_t* data;
+        StemStorage storage; // filled while downloading, see `available_frames()`
+        std::shared_ptr<StemCache> cache; // may be null
+        std::shared_ptr<StemCache> decoded_cache; // may be null
+        size_t file_bytes; // kept by lazy stems to decode evicted blocks
         std::atomic<uint32_t> waveform_ordinal;
         std::string waveform_base64;
     };
 
     using StemEntryPtr = std::shared_ptr<StemEntry>;
 
+    struct stem_codec;
+
+    /* Shared between the download of a stem and its decoder */
+    struct stem_download {
+        std::mutex mutex;
+        std::condition_variable data_arrived;
+        // Immutable once `finished` is set, lazy stems keep it afterwards
+        std::shared_ptr<std::vector<uint8_t>> data = std::make_shared<std::vector<uint8_t>>();
+        bool finished = false;
+        bool failed = false;
+        bool from_cache = false;
+        std::atomic_bool abort = false;
+    };
+
+    /* Audible stems, sorted by id. Those still decoding play up to their watermark */
+    using RenderList = std::vector<StemEntryPtr>;
+
+    struct retired_render_list {
+        std::unique_ptr<RenderList> list;
+        uint32_t render_epoch; // reader counter when the list was replaced
+    };
+
     static const float SHORT_TO_FLOAT;
     static const int STEM_DOWNLOAD_RETRY_COUNT;
+    static const uint32_t STREAM_CHUNK_BYTES;
+    static const int DOWNLOAD_CONNECTIONS;
+    static const uint32_t PARALLEL_DECODE_MIN_FRAMES;
+    static const int MAX_DECODE_RANGES;
+    static const int MAX_RENDER_WORKERS;
+    static const int RESERVED_CORES;
+    static const int MIN_STEMS_PER_PARTITION;
+    static const int BACKGROUND_WORKERS;
+    static const int BACKGROUND_HELPERS;
+    static const int64_t PASSED_STEM_RANK;
+    static const int64_t MUTED_STEM_RANK;
+    static const size_t DEFAULT_PCM_CACHE_BYTES;
+    static const int RETAINED_STEMS_HEAP_DIVISOR;
+    static const int FREE_HEAP_DIVISOR;
+    static const uint32_t DECODE_AHEAD_BLOCKS;
 
     /*
      * Locking strategy: because concurrent reads from STL containers are
      * thread safe, we will only be locking while writing to _stems map and 
      * while reading in the background thread (we assume all writes are
-     * performed in the main thread)
+     * performed in the main thread). The mixer never takes this lock,
+     * it reads the published render list instead.
     */
     mutable std::mutex _mutex;
 
     std::atomic<uint32_t> _length;
     std::unordered_map<uint32_t, StemEntryPtr> _stems;
+    // Complete stems removed with their song, from the least recently used
+    // one. Only used on the main thread, like `_stems` writes.
+    std::vector<StemEntryPtr> _retained_stems;
+    size_t _retained_stems_capacity;
     std::function<void()> _complete_cb;
+    std::unique_ptr<TaskPool> _task_pool; // all downloads, decoding and waveforms
+    std::shared_ptr<StemCache> _stem_cache;
+    std::shared_ptr<StemCache> _decoded_stem_cache;
+
+    // Helpers decoding ranges in parallel, shared by all stems so that they
+    // don't oversubscribe the CPU when a whole song loads at once
+    int _decode_thread_limit;
+    std::atomic<int> _decode_threads;
 
     std::unordered_set<uint32_t> _muted_stems;
     std::optional<uint32_t> _soloed_stem;
 
+    /*
+     * The render list is replaced as a whole (RCU style) under `_mutex`. 
+     * Render calls never overlap, so a single reader counter is enough - it
+     * is odd while a render is in progress. A replaced list is freed once 
+     * the counter shows that the render which might have used it is over,
+     * by the next rebuild or control call, or when the mixer next wakes
+     * the decode-ahead thread.
+    */
+    std::atomic<RenderList*> _render_list;
+    std::atomic<uint32_t> _render_epoch;
+    std::vector<retired_render_list> _retired_lists;
+
+    // Render state, owned by the thread that calls `render`
+    const RenderList* _rendered_list;
+    uint32_t _render_first_sample;
+    int _render_partitions;
+    int _render_frames;
+    std::unique_ptr<audio_block[]> _partial_buses;
+    std::unique_ptr<RenderPool> _render_pool;
+    uint32_t _render_stamp; // cache clock of the current render
+    uint32_t _playhead_block;
+
+    // Decoded blocks of lazy stems. A thread keeps the blocks just ahead of
+    // the playhead cached, the mixer wakes it up when it moves to the next
+    // block or finds one missing.
+    std::atomic_bool _lazy_decoding;
+    std::shared_ptr<PcmBlockCache> _pcm_cache;
+    std::atomic<uint32_t> _playhead;
+    std::atomic_bool _pcm_cache_missed;
+    std::atomic<uint32_t> _decode_ahead_signal;
+    std::atomic_bool _decode_ahead_quit;
+    std::thread _decode_ahead_thread;
+
     void switch_to_mute_mode();
+    void rebuild_render_list_locked();
+    void reclaim_render_lists();
+    void reclaim_render_lists_locked();
+
+    void render_partition(int partition);
+    void publish_stem_params_locked(StemEntry& stem);
+    void render_stem(const StemEntry& stem, uint32_t first_sample, const audio_span& block);
 
     void erase_unused_stems(const std::vector<stem_info>& info);
     void update_or_add_stems(const std::vector<stem_info>& info);
     StemEntryPtr create_stem_from_info(const stem_info& info);
+    StemEntryPtr reattach_retained_stem(const stem_info& info);
+    /* Also while the heap lacks `incoming_bytes` for new stems */
+    void evict_retained_stems(size_t incoming_bytes = 0);
+    void evict_oldest_retained_stem();
+    static size_t memory_bytes(const StemEntry& stem);
+    static size_t free_heap_bytes();
 
     void run_stem_processing(StemEntryPtr stem);
+    int64_t load_rank(const StemEntry& stem) const;
     void run_waveform_processing(StemEntryPtr stem, uint32_t prev_ordinal);
     void process_stem(StemEntryPtr stem);
-    bool decode_vorbis_stream(StemEntryPtr stem, const char* data, uint32_t data_size);
+    bool restore_decoded_stem(StemEntryPtr stem);
+    bool download_and_decode_stem(StemEntryPtr stem);
+    void download_stem(StemEntryPtr stem, stem_download& download);
+    bool decode_stem(StemEntryPtr stem, stem_download& download);
+    int reserve_decode_threads(int wanted);
+    void release_decode_threads(int threads);
+    void mark_stem_failed(StemEntryPtr stem);
+    void decode_ahead_main();
+    static const stem_codec& find_codec(const std::string& format);
     void process_stem_waveform(StemEntryPtr stem, uint32_t prev_ordinal);
 };
@@ -0,0 +1,159 @@
+#pragma once
+#include <pcm-block-cache.h>
+#include <silence-index.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * \class
+ * \brief Decoded stem audio (interleaved stereo int16), stored in fixed-size
+ *        segments where digitally silent segments take no memory at all
+ * 
+ * The segment table gives O(1) random access to any frame. Stored segments
+ * are allocated from larger pages. A storage is filled once by decoders
+ * through `Writer`s and is read-only after it's complete.
+ * 
+ * The mixer may read it while it's still being filled: everything below
+ * `available_frames()` is final. The watermark only grows, in whole segments
+ * until the end of the stem. `reset()` must not race with readers.
+ * 
+ * A lazy storage keeps no audio of its own. Decoded blocks go to a shared
+ * PCM block cache instead and are mapped into the segment table while they
+ * are cached, so a segment below the watermark may be missing. Evicted
+ * blocks are decoded again by the loader.
+ */
+class StemStorage {
+public:
+    static constexpr uint32_t SEGMENT_FRAMES = 1024;
+
+    /**
+     * \class
+     * \brief Fills one range of the storage, frame after frame
+     * 
+     * Writers of different ranges may run on different threads at the same
+     * time. The watermark only passes a range once all ranges before it are
+     * complete.
+     */
+    class Writer {
+    public:
+        /* The range has to start at a multiple of `commit_frames()` */
+        Writer(StemStorage& storage, uint32_t first_frame, uint32_t frames);
+        /* Decodes into `output` instead, the storage and its cache stay as they are */
+        Writer(StemStorage& storage, uint32_t first_frame, uint32_t frames, int16_t* output);
+
+        /* Frames past the end of the range are dropped */
+        void append(const int16_t* samples, uint32_t frames);
+        /* Ends the range early, at a commit boundary not before `position()` */
+        void set_end(uint32_t end_frame);
+        bool complete() const;
+
+        uint32_t position() const;
+        uint32_t end() const;
+
+    private:
+        StemStorage& _storage;
+        std::unique_ptr<int16_t[]> _staging;
+        uint32_t _staging_frames;
+        int16_t* _output; // where the next frame goes if not into the storage
+        uint32_t _position; // absolute, staged frames included
+        uint32_t _end;
+    };
+
+    /* Decodes a range of the stem again, for lazy storages */
+    using Loader = std::function<bool(Writer& writer)>;
+
+    StemStorage();
+    ~StemStorage();
+
+    /* The storage is lazy if a cache is given */
+    void reset(uint32_t frames, std::shared_ptr<PcmBlockCache> cache = nullptr);
+    bool complete() const;
+    bool lazy() const;
+    uint32_t commit_frames() const;
+
+    uint32_t frames() const;
+    uint32_t available_frames() const;
+    size_t stored_bytes() const;
+    size_t dense_bytes() const;
+    const SilenceIndex& silence() const;
+    /* Valid once the storage is complete */
+    bool dual_mono() const;
+
+    void set_loader(Loader loader);
+    /* Makes sure a block of a lazy storage is cached, may decode */
+    bool load_block(uint32_t block);
+    /* 
+     * For readers other than the mixer. Evicted blocks of lazy storages are
+     * decoded on the way, but not cached: a reader going through the whole
+     * stem would push the blocks around the playhead out.
+     */
+    bool read(uint32_t first_frame, uint32_t frames, int16_t* output);
+
+    /* 
+     * Snapshots of a complete, non-lazy storage, with the stored segments
+     * only. Restoring fills a freshly reset storage of the same length.
+     */
+    bool save(std::vector<uint8_t>& snapshot) const;
+    bool restore(const std::vector<uint8_t>& snapshot);
+
+    /* Returns nullptr if the segment is silent, or not cached if lazy */
+    const int16_t* segment(uint32_t index) const
+    {
+        return _segments[index].load();
+    }
+
+    /* The mixer marks blocks of lazy storages it has used */
+    void touch(uint32_t segment_index, uint32_t stamp) const
+    {
+        if (_block_stamps) {
+            _block_stamps[segment_index / SEGMENTS_PER_BLOCK].store(stamp, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    friend class PcmBlockCache;
+
+    static const uint32_t SEGMENTS_PER_PAGE;
+    static const uint32_t SNAPSHOT_MAGIC;
+    static constexpr uint32_t SEGMENTS_PER_BLOCK = PcmBlockCache::BLOCK_FRAMES / SEGMENT_FRAMES;
+
+    // Segment commits from all writers are serialized by this lock
+    mutable std::mutex _mutex;
+    std::unique_ptr<std::atomic<const int16_t*>[]> _segments; // sized up front
+    uint32_t _segment_count;
+    std::vector<bool> _committed;
+    uint32_t _committed_segments;
+    uint32_t _committed_prefix; // segments before the first missing one
+    std::vector<std::unique_ptr<int16_t[]>> _pages;
+    uint32_t _page_segments; // used segments of the last page
+    uint32_t _page_capacity; // segments that fit in the last page
+    size_t _page_bytes;
+    uint32_t _frames;
+    std::atomic<uint32_t> _available_frames; // published after the segment
+    SilenceIndex _silence;
+    bool _dual_mono;
+
+    // Lazy storages only
+    std::shared_ptr<PcmBlockCache> _cache;
+    std::vector<const int16_t*> _resident_blocks; // guarded by the cache's lock
+    std::unique_ptr<std::atomic<uint32_t>[]> _block_stamps;
+    Loader _loader;
+
+    void commit(uint32_t first_frame, const int16_t* samples, uint32_t frames);
+    bool index_segment_locked(uint32_t index, const int16_t* samples, uint32_t frames);
+    void advance_watermark_locked();
+    int16_t* allocate_segment_locked();
+
+    // Called by the cache, under its lock
+    const int16_t* resident_block(uint32_t block) const;
+    uint32_t block_stamp(uint32_t block) const;
+    void stamp_block(uint32_t block, uint32_t stamp);
+    void map_block(uint32_t block, const int16_t* samples);
+    void unmap_block(uint32_t block);
+};
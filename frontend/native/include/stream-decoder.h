@@ -0,0 +1,29 @@
+#pragma once
+#include <stem-storage.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * \class
+ * \brief Common interface of the compressed stem decoders
+ *
+ * A stream decoder gets the file in arbitrary pieces while it's downloading
+ * and appends the audio to its writer. Every decoder also has a static
+ * `decode_range()` of the `RangeDecoder` type, which decodes any range of a
+ * file that is already complete, exactly matching the streamed samples.
+ */
+class StreamDecoder {
+public:
+    /* Seeks to the writer's position in a complete file and decodes the range */
+    using RangeDecoder = bool (*)(const uint8_t* data, size_t bytes, StemStorage::Writer& writer,
+        const std::atomic_bool& cancelled);
+
+    virtual ~StreamDecoder() = default;
+
+    /* Returns false if the stream turned out not to be in the expected format */
+    virtual bool feed(const uint8_t* data, size_t bytes) = 0;
+    /* Call at the end of input, returns true if the whole stem has been decoded */
+    virtual bool finish() = 0;
+};
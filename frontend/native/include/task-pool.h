@@ -0,0 +1,108 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+struct task_pool_stats {
+    std::vector<uint32_t> queued; // per priority
+    uint32_t peak_queued;
+    uint32_t running; // including helpers
+    uint32_t completed;
+    uint32_t cancelled;
+    uint32_t coalesced;
+};
+
+/**
+ * \class
+ * \brief A fixed pool of threads for background work (downloading, decoding,
+ *        drawing waveforms), fed from queues of different priority
+ *
+ * Besides its workers, the pool has a few helper threads that running tasks
+ * may borrow for work that has to go on next to them, like the download of
+ * the stem being decoded. All background threads are the pool's, so their
+ * number is fixed.
+ *
+ * Workers always take a task from the most urgent non-empty queue: the one
+ * with the lowest rank, or the oldest one if ranks are equal. Ranks are
+ * evaluated each time a task is picked, so they may change while tasks wait.
+ * A task that has been cancelled while it waited is dropped without running,
+ * running tasks are expected to check their cancellation themselves.
+ */
+class TaskPool {
+public:
+    enum class Priority {
+        DECODE,   // audio that is about to be heard
+        WAVEFORM,
+        ANALYSIS,
+    };
+
+    static constexpr int PRIORITIES = 3;
+
+    using Task = std::function<void()>;
+    using CancelCheck = std::function<bool()>;
+    /* Called under the pool's lock, so it must not take any other locks */
+    using Rank = std::function<int64_t()>;
+
+    struct helper_job;
+    using HelperJob = std::shared_ptr<helper_job>;
+
+    TaskPool(int workers, int helpers);
+    /* Queued tasks are dropped, running ones are waited for */
+    ~TaskPool();
+
+    /*
+     * A nonzero `coalesce_key` makes the task replace a queued one of the same
+     * priority and key, e.g. an older version of the same waveform image.
+     * Tasks without a rank have rank 0.
+     */
+    void submit(Priority priority, Task task, CancelCheck cancelled = nullptr,
+        uint64_t coalesce_key = 0, Rank rank = nullptr);
+
+    /*
+     * Starts `task` on an idle helper thread right away. Returns null if all
+     * of them are busy - then the caller should do the work itself, waiting
+     * for a helper could deadlock. Helper tasks must not wait for queued ones.
+     */
+    HelperJob try_run_helper(Task task);
+    void wait_helper(const HelperJob& job);
+
+    task_pool_stats stats() const;
+
+private:
+    struct queued_task {
+        Task task;
+        CancelCheck cancelled;
+        uint64_t coalesce_key;
+        Rank rank;
+    };
+
+    mutable std::mutex _mutex;
+    std::condition_variable _task_queued;
+    std::deque<queued_task> _queues[PRIORITIES];
+    std::vector<std::thread> _threads;
+    bool _quit;
+
+    std::condition_variable _helper_queued;
+    std::condition_variable _helper_done;
+    std::deque<HelperJob> _helper_jobs;
+    std::vector<std::thread> _helper_threads;
+    uint32_t _idle_helpers;
+    bool _helpers_quit;
+
+    uint32_t _peak_queued;
+    uint32_t _running;
+    uint32_t _completed;
+    uint32_t _cancelled;
+    uint32_t _coalesced;
+
+    void thread_main();
+    void helper_main();
+    uint32_t queued_locked() const;
+    queued_task take_next_locked();
+};
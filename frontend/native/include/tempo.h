@@ -1,5 +1,7 @@
 #pragma once
+#include <atomic>
 #include <cstdint>
+#include <memory>
 #include <mutex>
 #include <vector>
 
@@ -23,11 +25,14 @@ struct song_position {
  * \brief This class keeps track of current BPM, time signature and
  *        track position.
  * 
- * It supports both stable and varying BPM types.
+ * It supports both stable and varying BPM types. The tempo map is replaced
+ * as a whole (RCU style), so readers never lock: the metronome queries it
+ * from the audio thread. A replaced map is freed once no reader is inside.
  */
 class Tempo {
 public:
     Tempo();
+    ~Tempo();
 
     void set_stable_bpm(double bpm, uint32_t time_signature_numerator);
     void set_varying_bpm(const std::vector<tempo_tag>& tempo_def);
@@ -44,25 +49,35 @@ private:
     enum class TempoMode { STABLE, VARYING };
     static const int TICKS_PER_STEP;
 
-    mutable std::mutex _mutex;
+    /* Immutable once published */
+    struct tempo_map {
+        TempoMode mode;
+        double stable_bpm;
+        double stable_samples_per_beat;
+        uint32_t stable_time_sig;
+        std::vector<tempo_tag> varying_bpm;
+    };
 
-    TempoMode _mode;
-    double _stable_bpm;
-    double _stable_samples_per_beat;
-    uint32_t _stable_time_sig;
-    std::vector<tempo_tag> _varying_bpm;
-    mutable uint32_t _last_varying_segment; // for optimization purposes
+    /* Keeps the current map alive for as long as it exists */
+    class MapReader;
+
+    std::mutex _write_mutex; // <-- writers only
+    std::atomic<const tempo_map*> _map;
+    mutable std::atomic<uint32_t> _readers;
+    std::vector<std::unique_ptr<const tempo_map>> _retired_maps;
+    mutable std::atomic<uint32_t> _last_varying_segment; // for optimization purposes
 
     static double samples_per_beat_from_bpm(double bpm);
+    void publish(std::unique_ptr<tempo_map> map);
 
-    song_position stable_current_position(uint32_t track_position) const;
-    uint32_t stable_bar_sample(uint32_t bar) const;
+    static song_position stable_current_position(const tempo_map& map, uint32_t track_position);
+    static uint32_t stable_bar_sample(const tempo_map& map, uint32_t bar);
 
-    size_t varying_bpm_binsearch(
-        size_t start, size_t end, uint32_t track_position) const;
-    size_t varying_find_segment_index(uint32_t track_position) const;
-    double varying_current_bpm(uint32_t track_position) const;
-    uint32_t varying_current_time_signature(uint32_t track_position) const;
-    song_position varying_current_position(uint32_t track_position) const;
-    uint32_t varying_bar_sample(uint32_t bar) const;
+    static size_t varying_bpm_binsearch(const tempo_map& map,
+        size_t start, size_t end, uint32_t track_position);
+    size_t varying_find_segment_index(const tempo_map& map, uint32_t track_position) const;
+    double varying_current_bpm(const tempo_map& map, uint32_t track_position) const;
+    uint32_t varying_current_time_signature(const tempo_map& map, uint32_t track_position) const;
+    song_position varying_current_position(const tempo_map& map, uint32_t track_position) const;
+    static uint32_t varying_bar_sample(const tempo_map& map, uint32_t bar);
 };
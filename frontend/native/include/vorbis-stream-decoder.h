@@ -0,0 +1,51 @@
+#pragma once
+#include <stem-storage.h>
+#include <stream-decoder.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+// Forward declarations
+struct stb_vorbis;
+
+/**
+ * \class
+ * \brief Decodes an Ogg Vorbis stream that arrives in arbitrary pieces, 
+ *        appending the audio to a stem storage as soon as a frame is complete
+ * 
+ * Built on stb_vorbis' pushdata API. Bytes that don't make a whole frame yet
+ * are kept until the next piece arrives. Decoding stops once the writer's
+ * range is complete.
+ * 
+ * Once the whole file is in memory, the rest can be split into ranges for
+ * `decode_range()`. Both paths produce exactly the same samples, so ranges
+ * join seamlessly.
+ */
+class VorbisStreamDecoder : public StreamDecoder {
+public:
+    explicit VorbisStreamDecoder(StemStorage::Writer& writer);
+    ~VorbisStreamDecoder();
+
+    bool feed(const uint8_t* data, size_t bytes) override;
+    bool finish() override;
+
+    /* A `StreamDecoder::RangeDecoder` */
+    static bool decode_range(const uint8_t* data, size_t bytes, StemStorage::Writer& writer,
+        const std::atomic_bool& cancelled);
+
+private:
+    static const int FRAME_BUFFER_FRAMES;
+
+    StemStorage::Writer& _writer;
+    stb_vorbis* _vorbis;
+    std::vector<uint8_t> _pending;
+    std::unique_ptr<int16_t[]> _frame_buffer;
+
+    void append_frame(int channels, float** outputs, int samples);
+    static void convert_to_stereo(int channels, float** outputs, int first, int samples, 
+        int16_t* output);
+};
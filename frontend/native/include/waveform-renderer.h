@@ -3,6 +3,9 @@
 #include <utility>
 #include <vector>
 
+// Forward declarations
+class StemStorage;
+
 class WaveformRenderer {
 public:
     WaveformRenderer();
@@ -20,10 +23,13 @@ public:
     void set_silence_min_length(uint32_t min_length_samples);
     uint32_t silence_min_length() const;
 
+    /* Lazy storages are decoded on the way, so it may take a while */
     std::vector<uint8_t> render_waveform_to_png(int32_t offset, uint32_t total_length,
-        const int16_t* samples, uint32_t num_samples);
+        StemStorage& samples);
 
 private:
+    class SampleReader;
+
     struct __attribute__((packed)) pixel {
         uint8_t red;
         uint8_t green;
@@ -31,21 +37,28 @@ private:
         uint8_t alpha;
     };
 
+    struct column_peaks {
+        int16_t hi;
+        int16_t low;
+    };
+
+    struct silence_span {
+        uint32_t start;
+        uint32_t end;
+    };
+
     int _output_width, _output_height;
     uint8_t _color_red, _color_green, _color_blue, _color_alpha;
     uint8_t _silence_alpha;
     int16_t _silence_threshold;
     uint32_t _silence_min_length;
 
-    void process_waveform(pixel* image, int32_t offset, uint32_t total_length,
-        const int16_t* samples, uint32_t num_samples);
-    void process_silence(pixel* image, int32_t offset, uint32_t total_length,
-        const int16_t* samples, uint32_t num_samples);
+    void scan_samples(int32_t offset, uint32_t total_length, StemStorage& samples,
+        std::vector<column_peaks>& peaks, std::vector<silence_span>& silences);
+    void draw_waveform(pixel* image, const std::vector<column_peaks>& peaks);
     void draw_silence(pixel* image, uint32_t total_length, int& column, 
         uint32_t silence_start, uint32_t silence_end);
     void blend_pixel(pixel& src, const pixel& over);
-    std::pair<int16_t, int16_t> get_column_peaks(uint32_t start_sample, uint32_t end_sample,
-        int32_t offset, const int16_t* samples, uint32_t num_samples);
     uint32_t get_column_end_sample(int x, uint32_t total_length) const;
     int peak_to_pixel(int16_t peak) const;
 }; 
@@ -0,0 +1,31 @@
+#include <audible-clock.h>
+
+#include <cstddef>
+
+
+static_assert(sizeof(double) == 8 && sizeof(uint32_t) == 4);
+
+AudibleClock::AudibleClock()
+    : _record{ 0.0, 0, 0, 0, 0 }
+{
+}
+
+void AudibleClock::publish(double context_time, uint32_t position, bool playing)
+{
+    std::atomic_ref sequence(_record.sequence);
+    uint32_t current = sequence.load(std::memory_order_relaxed);
+
+    sequence.store(current + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    std::atomic_ref(_record.context_time).store(context_time, std::memory_order_relaxed);
+    std::atomic_ref(_record.position).store(position, std::memory_order_relaxed);
+    std::atomic_ref(_record.playing).store(playing ? 1 : 0, std::memory_order_relaxed);
+
+    sequence.store(current + 2, std::memory_order_release);
+}
+
+uintptr_t AudibleClock::address() const
+{
+    return reinterpret_cast<uintptr_t>(&_record);
+}
@@ -1,86 +1,176 @@
 #include <audio-buffer.h>
 
+#include <algorithm>
+#include <bit>
 #include <cassert>
-#include <cstdio>
-#include <thread>
 
 
 AudioBuffer::AudioBuffer(int sampleSize)
-    : _underflow_count(0)
-    , _read_idx(0)
+    : _read_idx(0)
     , _write_idx(0)
-    , _reset_counter(0)
+    , _epoch(0)
+    , _underflow_count(0)
+    , _low_read_fill(NO_READS)
+    , _read_fill_sequence(0)
+    , _reserved_epoch(0)
 {
     assert(sampleSize > 0);
 
-    _array_size = sampleSize / AUDIO_CHUNK_SAMPLES;
+    uint32_t chunks = sampleSize / AUDIO_CHUNK_SAMPLES;
     if (sampleSize % AUDIO_CHUNK_SAMPLES) {
-        ++_array_size; // Make it ceil() instead of floor()
+        ++chunks; // Make it ceil() instead of floor()
     }
 
-    _chunk_array = std::make_unique<audio_chunk[]>(_array_size);
+    _array_size = std::bit_ceil(chunks);
+    _index_mask = _array_size - 1;
+    _slots = std::make_unique<slot[]>(_array_size);
+    _target_chunks = _array_size;
 }
 
 int AudioBuffer::underflow_count() const
 {
-    return _underflow_count;
+    return _underflow_count.load(std::memory_order_relaxed);
 }
 
-bool AudioBuffer::operator>>(audio_chunk& target)
+uint32_t AudioBuffer::epoch() const
 {
-    std::lock_guard lock(_read_lock);
-    int current_read_idx = _read_idx.load();
+    return _epoch.load(std::memory_order_acquire);
+}
+
+void AudioBuffer::clear()
+{
+    _epoch.fetch_add(1, std::memory_order_acq_rel);
+}
 
-    if (current_read_idx == _write_idx) {
-        ++_underflow_count;
-        return false;
+int AudioBuffer::capacity() const
+{
+    return _array_size * AUDIO_CHUNK_SAMPLES;
+}
+
+void AudioBuffer::set_target_size(int sampleSize)
+{
+    int chunks = sampleSize / AUDIO_CHUNK_SAMPLES;
+    if (sampleSize % AUDIO_CHUNK_SAMPLES) {
+        ++chunks;
     }
 
-    memcpy(&target, &_chunk_array[current_read_idx], sizeof(audio_chunk));
+    chunks = std::clamp<int>(chunks, 1, _array_size);
+    _target_chunks.store(chunks, std::memory_order_relaxed);
+}
 
-    int next_cell = current_read_idx + 1;
-    if (next_cell >= _array_size) next_cell = 0;
+int AudioBuffer::target_size() const
+{
+    return _target_chunks.load(std::memory_order_relaxed) * AUDIO_CHUNK_SAMPLES;
+}
 
-    _read_idx.compare_exchange_strong(current_read_idx, next_cell);
-    _read_idx.notify_one();
-    return true;
+int AudioBuffer::fill_level() const
+{
+    uint32_t write_idx = _write_idx.load(std::memory_order_relaxed);
+    uint32_t read_idx = _read_idx.load(std::memory_order_acquire);
+
+    return static_cast<int>(write_idx - read_idx) * AUDIO_CHUNK_SAMPLES;
 }
 
-AudioBuffer& AudioBuffer::operator<<(const audio_chunk& source)
+audio_chunk* AudioBuffer::reserve_write()
 {
-    std::unique_lock lock(_write_lock);
-    int current_write_idx = _write_idx;
+    // A chunk that started before clear() must not end up after it
+    _reserved_epoch = _epoch.load(std::memory_order_acquire);
+    uint32_t write_idx = _write_idx.load(std::memory_order_relaxed);
+    uint32_t read_idx = _read_idx.load(std::memory_order_acquire);
+
+    while (write_idx - read_idx >= _target_chunks.load(std::memory_order_relaxed)) {
+        _read_idx.wait(read_idx, std::memory_order_acquire);
+        read_idx = _read_idx.load(std::memory_order_acquire);
+    }
 
-    int next_cell = current_write_idx + 1;
-    if (next_cell >= _array_size) next_cell = 0;
+    return &_slots[write_idx & _index_mask].chunk;
+}
 
-    int previous_reset_counter = _reset_counter;
-    lock.unlock();
+void AudioBuffer::commit_write(const chunk_stamp& stamp)
+{
+    uint32_t write_idx = _write_idx.load(std::memory_order_relaxed);
+    _slots[write_idx & _index_mask].stamp = stamp;
+    _slots[write_idx & _index_mask].epoch = _reserved_epoch;
 
-    _read_idx.wait(next_cell);
+    _write_idx.store(write_idx + 1, std::memory_order_release);
+}
 
-    lock.lock();
+uint32_t AudioBuffer::take_low_read_fill()
+{
+    // A fill the reader records right in between is lost, which doesn't
+    // matter much for a statistic collected over thousands of reads
+    uint32_t sequence = _read_fill_sequence.load(std::memory_order_relaxed);
+    uint64_t low = _low_read_fill.load(std::memory_order_relaxed);
+    _read_fill_sequence.store(sequence + 1, std::memory_order_relaxed);
 
-    if (previous_reset_counter == _reset_counter) {
-        memcpy(&_chunk_array[current_write_idx], &source, sizeof(audio_chunk));
-        _write_idx.compare_exchange_strong(current_write_idx, next_cell);
-    } else {
-        printf("[AudioBuffer] Omitting a single write to the circular buffer - reset detected!\n");
+    return (low >> 32) == sequence ? static_cast<uint32_t>(low) : NO_READS;
+}
+
+const audio_chunk* AudioBuffer::peek_read(chunk_stamp* stamp)
+{
+    uint32_t read_idx = _read_idx.load(std::memory_order_relaxed);
+    uint32_t write_idx = _write_idx.load(std::memory_order_acquire);
+    uint32_t epoch = _epoch.load(std::memory_order_acquire);
+    bool dropped = false;
+
+    // Skip everything that was written before the last clear(). This loop
+    // is bounded by the array size, so the reader stays wait-free.
+    while (read_idx != write_idx && _slots[read_idx & _index_mask].epoch != epoch) {
+        ++read_idx;
+        dropped = true;
+    }
+
+    if (dropped) {
+        _read_idx.store(read_idx, std::memory_order_release);
+        _read_idx.notify_one();
+    }
+
+    if (read_idx == write_idx) {
+        // An empty buffer right after a reset is expected, do not count it
+        if (!dropped) {
+            _underflow_count.fetch_add(1, std::memory_order_relaxed);
+            record_read_fill(0);
+        }
+        return nullptr;
+    }
+
+    record_read_fill(write_idx - read_idx);
+
+    if (stamp) {
+        *stamp = _slots[read_idx & _index_mask].stamp;
     }
 
-    return *this;
+    return &_slots[read_idx & _index_mask].chunk;
 }
 
-void AudioBuffer::clear()
+void AudioBuffer::release_read()
+{
+    uint32_t read_idx = _read_idx.load(std::memory_order_relaxed);
+
+    _read_idx.store(read_idx + 1, std::memory_order_release);
+    _read_idx.notify_one();
+}
+
+void AudioBuffer::discard()
 {
-    std::lock_guard lock(_read_lock);
-    std::lock_guard lock2(_write_lock);
+    uint32_t read_idx = _read_idx.load(std::memory_order_relaxed);
+    uint32_t write_idx = _write_idx.load(std::memory_order_acquire);
 
-    for (int i = 0; i < _array_size; ++i) {
-        memset(&_chunk_array[i], 0, sizeof(audio_chunk));
+    if (read_idx != write_idx) {
+        _read_idx.store(write_idx, std::memory_order_release);
+        _read_idx.notify_one();
     }
+}
 
-    ++_reset_counter;
-    _read_idx = _write_idx.load();
-    _read_idx.notify_one();
+void AudioBuffer::record_read_fill(uint32_t chunks)
+{
+    // A plain store, the reader stays wait-free. The minimum of an older
+    // sequence number has been taken (or abandoned) by the writer already.
+    uint64_t sequence = _read_fill_sequence.load(std::memory_order_relaxed);
+    uint64_t recorded = _low_read_fill.load(std::memory_order_relaxed);
+    uint32_t low = (recorded >> 32) == sequence ? static_cast<uint32_t>(recorded) : NO_READS;
+
+    if (chunks < low) {
+        _low_read_fill.store(sequence << 32 | chunks, std::memory_order_relaxed);
+    }
 }
@@ -1,8 +1,14 @@
 #include <audio-worklet.h>
 
 #include <audio-buffer.h>
+#include <mixer.h>
+#include <performance-monitor.h>
+
+#include <emscripten.h>
 #include <emscripten/webaudio.h>
 
+#include <cstring>
+
 
 uint8_t audio_thread_stack[4096];
 static const char* WORKLET_NODE_NAME = "glissando-processor";
@@ -13,7 +19,7 @@ AudioWorklet::AudioWorklet()
 {
     EmscriptenWebAudioCreateAttributes options = {
         .latencyHint = "interactive",
-        .sampleRate = AUDIO_SAMPLE_RATE,
+        .sampleRate = 0, // Use the native rate of the output device, the mixer resamples to it
     };
 
     EMSCRIPTEN_WEBAUDIO_T context = emscripten_create_audio_context(&options);
@@ -31,7 +37,41 @@ AudioWorklet::~AudioWorklet()
 
 void AudioWorklet::process_audio(audio_chunk* output_buffer)
 {
-    if (_audio_buffer && (*_audio_buffer) >> (*output_buffer)) {
+    Mixer* mixer = _mixer.load(std::memory_order_acquire);
+
+    if (mixer && mixer->direct_rendering()) {
+        // Whatever the mixer thread has left in the buffer is obsolete now,
+        // dropping it also lets the mixer thread notice the mode change
+        if (_audio_buffer) _audio_buffer->discard();
+
+        chunk_stamp stamp = mixer->render_direct(*output_buffer);
+        _clock.publish(context_time(), stamp.position, stamp.playing);
+        return;
+    }
+
+    const audio_chunk* chunk = nullptr;
+    chunk_stamp stamp;
+
+    if (_audio_buffer) {
+        int underflows = _audio_buffer->underflow_count();
+        int fill_level = _audio_buffer->fill_level();
+        chunk = _audio_buffer->peek_read(&stamp);
+
+        if (_monitor) {
+            double now = emscripten_get_now();
+            _monitor->record_read(fill_level, now);
+
+            if (_audio_buffer->underflow_count() != underflows) {
+                _monitor->record_underflow(now);
+            }
+        }
+    }
+
+    if (chunk) {
+        memcpy(output_buffer, chunk, sizeof(audio_chunk));
+        _audio_buffer->release_read();
+
+        _clock.publish(context_time(), stamp.position, stamp.playing);
         return;
     }
 
@@ -41,6 +81,20 @@ void AudioWorklet::process_audio(audio_chunk* output_buffer)
     }
 }
 
+int AudioWorklet::sample_rate() const
+{
+    return MAIN_THREAD_EM_ASM_INT({
+        return emscriptenGetAudioObject($0).sampleRate;
+    }, _audio_context);
+}
+
+double AudioWorklet::context_time() const
+{
+    // `currentTime` is a global of AudioWorkletGlobalScope and holds
+    // the context time of the quantum that is being processed
+    return EM_ASM_DOUBLE({ return currentTime; });
+}
+
 void AudioWorklet::callback_audio_thread_initialized(
     EMSCRIPTEN_WEBAUDIO_T audio_context, EM_BOOL success, void *user_data)
 {
@@ -72,20 +126,10 @@ void AudioWorklet::callback_audio_worklet_processor_created(
         &AudioWorklet::callback_process_audio, user_data);
 
     // Setup audio path
+    // Output trim and clipping are done by the mixer's output stage
     EM_ASM({
         const audioCtx = emscriptenGetAudioObject($1);
-        const clipperNode = new WaveShaperNode(audioCtx, {
-            curve: new Float32Array([-1, 1]),
-        });
-        // ^----- Apply clipping
-        const gainNode = new GainNode(audioCtx);
-        gainNode.gain.setValueAtTime(0.85, audioCtx.currentTime); 
-        // ^---- Windows mixer tries to apply its own limiting,
-        // especially if upsampling. Give him a bit of a headroom...
-
-        emscriptenGetAudioObject($0).connect(clipperNode);
-        clipperNode.connect(gainNode);
-        gainNode.connect(audioCtx.destination);
+        emscriptenGetAudioObject($0).connect(audioCtx.destination);
 
         window.audioContext = audioCtx;
         console.info(`Output sample rate is ${window.audioContext.sampleRate} Hz`);
@@ -1,15 +1,46 @@
 #include <mixer.h>
+#include <performance-monitor.h>
 #include <stem-manager.h>
 #include <tempo.h>
 
 #include <emscripten/bind.h>
+#include <emscripten/val.h>
 
 using namespace emscripten;
 extern Mixer* get_global_mixer();
+extern uintptr_t get_audible_clock_address();
+extern void attach_stem_cache();
+
+// Returns a plain JS object, so that it can be serialized straight into a bug report
+static val get_performance_stats(const Mixer& mixer)
+{
+    performance_stats stats = mixer.collect_performance_stats();
+
+    val result = val::object();
+    result.set("mixdownBucketMs", stats.mixdown_bucket_ms);
+    result.set("mixdownHistogram", val::array(stats.mixdown_histogram));
+    result.set("mixdownMeanMs", stats.mixdown_mean_ms);
+    result.set("mixdownMaxMs", stats.mixdown_max_ms);
+    result.set("fillBucketSamples", stats.fill_bucket_samples);
+    result.set("fillHistogram", val::array(stats.fill_histogram));
+    result.set("worstJitterMs", stats.worst_jitter_ms);
+    result.set("underflowCount", stats.underflow_count);
+    result.set("underflowTimestampsMs", val::array(stats.underflow_timestamps_ms));
+    result.set("outputLatency", stats.output_latency);
+    result.set("taskQueueDepths", val::array(stats.task_queue_depths));
+    result.set("taskQueuePeak", stats.task_queue_peak);
+    result.set("tasksRunning", stats.tasks_running);
+    result.set("tasksCompleted", stats.tasks_completed);
+    result.set("tasksCancelled", stats.tasks_cancelled);
+    result.set("tasksCoalesced", stats.tasks_coalesced);
+    return result;
+}
 
 
 EMSCRIPTEN_BINDINGS(editor) {
     function("getGlobalMixer", &get_global_mixer, allow_raw_pointer<Mixer>());
+    function("getAudibleClockAddress", &get_audible_clock_address);
+    function("attachStemCache", &attach_stem_cache);
     class_<Mixer>("Mixer")
         .function("testJsBinding", &Mixer::test_js_binding)
         .function("play", &Mixer::play)
@@ -20,8 +51,10 @@ EMSCRIPTEN_BINDINGS(editor) {
         .function("setPlaybackPosition", &Mixer::set_playback_position)
         .function("getPlaybackPosition", &Mixer::playback_position)
         .function("getPlaybackPositionBst", &Mixer::playback_position_bst)
+        .function("getSongPosition", &Mixer::song_position_at)
         .function("getBarSample", &Mixer::bar_sample)
         .function("getSampleRate", &Mixer::sample_rate)
+        .function("getOutputSampleRate", &Mixer::output_sample_rate)
         .function("setMetronomeEnabled", &Mixer::set_metronome_enabled)
         .function("toggleMetronome", &Mixer::toggle_metronome)
         .function("isMetronomeEnabled", &Mixer::metronome_enabled)
@@ -44,11 +77,31 @@ EMSCRIPTEN_BINDINGS(editor) {
         .function("unmuteAll", &Mixer::unmute_all)
         .function("isStemMuted", &Mixer::stem_muted)
         .function("isStemSoloed", &Mixer::stem_soloed)
+        .function("setLazyDecoding", &Mixer::set_lazy_decoding)
+        .function("isLazyDecoding", &Mixer::lazy_decoding)
+        .function("setPcmCacheSizeMb", &Mixer::set_pcm_cache_size_mb)
+        .function("getPcmCacheSizeMb", &Mixer::pcm_cache_size_mb)
+        .function("setStemCacheSizeMb", &Mixer::set_stem_cache_size_mb)
+        .function("getStemCacheSizeMb", &Mixer::stem_cache_size_mb)
+        .function("setDecodedStemCacheSizeMb", &Mixer::set_decoded_stem_cache_size_mb)
+        .function("getDecodedStemCacheSizeMb", &Mixer::decoded_stem_cache_size_mb)
+        .function("setRetainedStemsSizeMb", &Mixer::set_retained_stems_size_mb)
+        .function("getRetainedStemsSizeMb", &Mixer::retained_stems_size_mb)
         .function("getLimiterReductionDb", &Mixer::limiter_reduction_db)
+        .function("setOutputTrimDb", &Mixer::set_output_trim_db)
+        .function("getOutputTrimDb", &Mixer::output_trim_db)
+        .function("setRenderBlockSize", &Mixer::set_render_block_size)
+        .function("getRenderBlockSize", &Mixer::render_block_size)
+        .function("setOutputLatencyBounds", &Mixer::set_output_latency_bounds)
+        .function("getOutputLatency", &Mixer::output_latency)
+        .function("getPerformanceStats", &get_performance_stats)
+        .function("setDirectRendering", &Mixer::set_direct_rendering)
+        .function("isDirectRendering", &Mixer::direct_rendering)
         ;
     value_object<stem_info>("StemInfo")
         .field("id", &stem_info::id)
         .field("path", &stem_info::path)
+        .field("format", &stem_info::format)
         .field("samples", &stem_info::samples)
         .field("offset", &stem_info::offset)
         .field("gainDb", &stem_info::gain_db)
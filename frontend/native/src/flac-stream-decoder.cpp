@@ -0,0 +1,797 @@
+#include <flac-stream-decoder.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+
+const size_t FlacStreamDecoder::BISECT_MIN_BYTES = 64 * 1024; // decoded linearly from here
+const uint32_t FlacStreamDecoder::OUTPUT_BUFFER_FRAMES = 4096;
+
+static constexpr std::array<uint8_t, 256> make_crc8_table()
+{
+    std::array<uint8_t, 256> table {};
+    for (int i = 0; i < 256; ++i) {
+        uint8_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+static constexpr std::array<uint16_t, 256> make_crc16_table()
+{
+    std::array<uint16_t, 256> table {};
+    for (int i = 0; i < 256; ++i) {
+        uint16_t crc = i << 8;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1;
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+static constexpr auto CRC8_TABLE = make_crc8_table();
+static constexpr auto CRC16_TABLE = make_crc16_table();
+
+
+/* Reads big-endian bit fields, running past the end only sets a flag */
+class FlacStreamDecoder::BitReader {
+public:
+    BitReader(const uint8_t* data, size_t bytes)
+        : _data(data)
+        , _bytes(bytes)
+        , _position(0)
+        , _cache(0)
+        , _cached_bits(0)
+        , _overrun(false)
+    {
+    }
+
+    /* Up to 32 bits */
+    uint32_t read(int bits)
+    {
+        if (bits == 0) {
+            return 0;
+        }
+
+        if (_cached_bits < bits) {
+            refill();
+
+            if (_cached_bits < bits) {
+                _overrun = true;
+                _cache = 0;
+                _cached_bits = 0;
+                return 0;
+            }
+        }
+
+        uint32_t value = _cache >> (64 - bits);
+        _cache <<= bits;
+        _cached_bits -= bits;
+        return value;
+    }
+
+    int32_t read_signed(int bits)
+    {
+        if (bits == 0) {
+            return 0;
+        }
+
+        return static_cast<int32_t>(read(bits) << (32 - bits)) >> (32 - bits);
+    }
+
+    /* Counts zero bits up to the next one, which is consumed too */
+    uint32_t read_unary()
+    {
+        uint32_t zeros = 0;
+
+        while (true) {
+            if (_cached_bits == 0) {
+                refill();
+
+                if (_cached_bits == 0) {
+                    _overrun = true;
+                    return 0;
+                }
+            }
+
+            // Bits below the cached ones are always zero
+            int leading = _cache ? __builtin_clzll(_cache) : 64;
+            if (leading < _cached_bits) {
+                _cache = leading == 63 ? 0 : _cache << (leading + 1);
+                _cached_bits -= leading + 1;
+                return zeros + leading;
+            }
+
+            zeros += _cached_bits;
+            _cache = 0;
+            _cached_bits = 0;
+        }
+    }
+
+    void align()
+    {
+        read(_cached_bits % 8);
+    }
+
+    /* Only valid when aligned */
+    size_t byte_position() const
+    {
+        return _position - _cached_bits / 8;
+    }
+
+    bool overrun() const
+    {
+        return _overrun;
+    }
+
+private:
+    const uint8_t* _data;
+    size_t _bytes;
+    size_t _position;
+    uint64_t _cache; // left-aligned
+    int _cached_bits;
+    bool _overrun;
+
+    void refill()
+    {
+        while (_cached_bits <= 56 && _position < _bytes) {
+            _cache |= static_cast<uint64_t>(_data[_position++]) << (56 - _cached_bits);
+            _cached_bits += 8;
+        }
+    }
+};
+
+
+/* Decodes one frame at a time into 32-bit channel buffers */
+class FlacStreamDecoder::FrameDecoder {
+public:
+    enum class Status {
+        OK,
+        INCOMPLETE, // more data is needed
+        INVALID,
+    };
+
+    struct stream_info {
+        uint32_t min_block_size;
+        uint32_t max_block_size;
+        uint32_t sample_rate;
+        int channels;
+        int bits_per_sample;
+        uint64_t total_samples;
+    };
+
+    /* Reads the "fLaC" marker and all metadata blocks */
+    static Status parse_stream_info(const uint8_t* data, size_t bytes, stream_info& info,
+        size_t& used)
+    {
+        if (bytes < 4) {
+            return Status::INCOMPLETE;
+        }
+
+        if (memcmp(data, "fLaC", 4) != 0) {
+            return Status::INVALID;
+        }
+
+        size_t offset = 4;
+        bool found_info = false;
+        bool last = false;
+
+        while (!last) {
+            if (bytes - offset < 4) {
+                return Status::INCOMPLETE;
+            }
+
+            last = data[offset] & 0x80;
+            int type = data[offset] & 0x7F;
+            size_t length = (data[offset + 1] << 16) | (data[offset + 2] << 8) | data[offset + 3];
+            offset += 4;
+
+            if (bytes - offset < length) {
+                return Status::INCOMPLETE;
+            }
+
+            if (type == METADATA_STREAMINFO) {
+                if (length < 34) {
+                    return Status::INVALID;
+                }
+
+                BitReader reader(data + offset, length);
+                info.min_block_size = reader.read(16);
+                info.max_block_size = reader.read(16);
+                reader.read(24); // minimum frame size
+                reader.read(24); // maximum frame size
+                info.sample_rate = reader.read(20);
+                info.channels = reader.read(3) + 1;
+                info.bits_per_sample = reader.read(5) + 1;
+                info.total_samples = static_cast<uint64_t>(reader.read(4)) << 32;
+                info.total_samples |= reader.read(32);
+                found_info = true;
+            }
+
+            offset += length;
+        }
+
+        if (!found_info) {
+            return Status::INVALID;
+        }
+
+        bool supported = info.min_block_size >= 16 && info.max_block_size >= info.min_block_size
+            && info.bits_per_sample >= 4 && info.bits_per_sample <= MAX_BITS_PER_SAMPLE;
+        if (!supported) {
+            return Status::INVALID;
+        }
+
+        used = offset;
+        return Status::OK;
+    }
+
+    explicit FrameDecoder(const stream_info& info)
+        : _info(info)
+        , _output(std::make_unique<int16_t[]>(2 * OUTPUT_BUFFER_FRAMES))
+    {
+        for (auto& buffer : _buffers) {
+            buffer = std::make_unique<int32_t[]>(info.max_block_size);
+        }
+    }
+
+    Status decode_frame(const uint8_t* data, size_t bytes, size_t& used)
+    {
+        BitReader reader(data, bytes);
+        Status status = read_frame_header(reader, data);
+        if (status != Status::OK) {
+            return status;
+        }
+
+        for (int channel = 0; channel < _header.channels; ++channel) {
+            int bits = _header.bits_per_sample;
+            if ((channel == 1 && _header.assignment == LEFT_SIDE)
+                || (channel == 1 && _header.assignment == MID_SIDE)
+                || (channel == 0 && _header.assignment == SIDE_RIGHT)) {
+                ++bits; // the side channel
+            }
+
+            // Only the first two channels are played
+            int32_t* output = _buffers[std::min(channel, 2)].get();
+            status = decode_subframe(reader, bits, output);
+            if (status != Status::OK) {
+                return status;
+            }
+        }
+
+        reader.align();
+        size_t frame_bytes = reader.byte_position();
+        uint16_t crc = reader.read(16);
+
+        if (reader.overrun()) {
+            return Status::INCOMPLETE;
+        }
+
+        if (crc16(data, frame_bytes) != crc) {
+            return Status::INVALID;
+        }
+
+        decorrelate();
+        used = frame_bytes + 2;
+        return Status::OK;
+    }
+
+    /* Finds the first valid frame at or after `from` and decodes it */
+    bool find_frame(const uint8_t* data, size_t bytes, size_t from, size_t& offset)
+    {
+        for (size_t i = from; i + 1 < bytes; ++i) {
+            if (data[i] != 0xFF || (data[i + 1] & 0xFE) != 0xF8) {
+                continue;
+            }
+
+            size_t used = 0;
+            if (decode_frame(data + i, bytes - i, used) == Status::OK) {
+                offset = i;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    uint64_t first_sample() const
+    {
+        return _header.first_sample;
+    }
+
+    uint32_t block_size() const
+    {
+        return _header.block_size;
+    }
+
+    /* Appends the decoded frame to the writer, from the given sample on */
+    void append(StemStorage::Writer& writer, uint32_t first)
+    {
+        for (; first < _header.block_size && !writer.complete(); first += OUTPUT_BUFFER_FRAMES) {
+            uint32_t count = std::min(_header.block_size - first, OUTPUT_BUFFER_FRAMES);
+            convert_to_stereo(first, count);
+            writer.append(_output.get(), count);
+        }
+    }
+
+private:
+    enum {
+        METADATA_STREAMINFO = 0,
+        LEFT_SIDE = 8,
+        SIDE_RIGHT = 9,
+        MID_SIDE = 10,
+        MAX_BITS_PER_SAMPLE = 24,
+        MAX_LPC_ORDER = 32,
+    };
+
+    struct frame_header {
+        uint64_t first_sample;
+        uint32_t block_size;
+        int channels;
+        int assignment; // channel count - 1 if independent, or the stereo mode
+        int bits_per_sample;
+    };
+
+    stream_info _info;
+    frame_header _header;
+    std::unique_ptr<int32_t[]> _buffers[3]; // left, right and the rest
+    std::unique_ptr<int16_t[]> _output;
+
+    static uint8_t crc8(const uint8_t* data, size_t bytes)
+    {
+        uint8_t crc = 0;
+        for (size_t i = 0; i < bytes; ++i) {
+            crc = CRC8_TABLE[crc ^ data[i]];
+        }
+        return crc;
+    }
+
+    static uint16_t crc16(const uint8_t* data, size_t bytes)
+    {
+        uint16_t crc = 0;
+        for (size_t i = 0; i < bytes; ++i) {
+            crc = (crc << 8) ^ CRC16_TABLE[(crc >> 8) ^ data[i]];
+        }
+        return crc;
+    }
+
+    /* The UTF-8 like coded frame or sample number */
+    static bool read_coded_number(BitReader& reader, uint64_t& number)
+    {
+        uint32_t first = reader.read(8);
+        int length = 0;
+        while (length < 8 && (first & (0x80 >> length))) {
+            ++length;
+        }
+
+        if (length == 0) {
+            number = first;
+            return true;
+        }
+
+        if (length == 1 || length > 7) {
+            return false;
+        }
+
+        number = first & (0x7F >> length);
+        for (int i = 1; i < length; ++i) {
+            uint32_t byte = reader.read(8);
+            if ((byte & 0xC0) != 0x80) {
+                return false;
+            }
+
+            number = (number << 6) | (byte & 0x3F);
+        }
+
+        return true;
+    }
+
+    Status read_frame_header(BitReader& reader, const uint8_t* data)
+    {
+        // 14 sync bits followed by a reserved zero bit
+        if (reader.read(15) != 0x7FFC) {
+            return reader.overrun() ? Status::INCOMPLETE : Status::INVALID;
+        }
+
+        bool variable_block_size = reader.read(1);
+        uint32_t size_code = reader.read(4);
+        uint32_t rate_code = reader.read(4);
+        uint32_t channel_code = reader.read(4);
+        uint32_t bits_code = reader.read(3);
+        bool reserved = reader.read(1);
+
+        uint64_t number = 0;
+        bool valid = read_coded_number(reader, number) && !reserved;
+        if (reader.overrun()) {
+            return Status::INCOMPLETE;
+        }
+
+        if (!valid) {
+            return Status::INVALID;
+        }
+
+        frame_header header;
+        if (size_code == 0) {
+            return Status::INVALID;
+        } else if (size_code == 1) {
+            header.block_size = 192;
+        } else if (size_code <= 5) {
+            header.block_size = 576 << (size_code - 2);
+        } else if (size_code == 6) {
+            header.block_size = reader.read(8) + 1;
+        } else if (size_code == 7) {
+            header.block_size = reader.read(16) + 1;
+        } else {
+            header.block_size = 256 << (size_code - 8);
+        }
+
+        // The sample rate doesn't matter here, it's only skipped
+        if (rate_code == 12) {
+            reader.read(8);
+        } else if (rate_code == 13 || rate_code == 14) {
+            reader.read(16);
+        } else if (rate_code == 15) {
+            return Status::INVALID;
+        }
+
+        if (channel_code <= 7) {
+            header.channels = channel_code + 1;
+        } else if (channel_code <= MID_SIDE) {
+            header.channels = 2;
+        } else {
+            return Status::INVALID;
+        }
+
+        static const int SAMPLE_SIZES[8] = { 0, 8, 12, -1, 16, 20, 24, 32 };
+        header.assignment = channel_code;
+        header.bits_per_sample = bits_code == 0 ? _info.bits_per_sample : SAMPLE_SIZES[bits_code];
+
+        size_t header_bytes = reader.byte_position();
+        uint8_t crc = reader.read(8);
+        if (reader.overrun()) {
+            return Status::INCOMPLETE;
+        }
+
+        if (crc8(data, header_bytes) != crc) {
+            return Status::INVALID;
+        }
+
+        bool supported = header.block_size <= _info.max_block_size
+            && header.channels == _info.channels
+            && header.bits_per_sample >= 4 && header.bits_per_sample <= MAX_BITS_PER_SAMPLE;
+        if (!supported) {
+            return Status::INVALID;
+        }
+
+        // Fixed block size streams count frames instead of samples
+        header.first_sample = variable_block_size ? number : number * _info.max_block_size;
+        _header = header;
+        return Status::OK;
+    }
+
+    Status decode_subframe(BitReader& reader, int bits, int32_t* output)
+    {
+        uint32_t block_size = _header.block_size;
+
+        bool padding = reader.read(1);
+        uint32_t type = reader.read(6);
+        int wasted_bits = 0;
+        if (reader.read(1)) {
+            wasted_bits = reader.read_unary() + 1;
+        }
+
+        if (padding || wasted_bits >= bits) {
+            return reader.overrun() ? Status::INCOMPLETE : Status::INVALID;
+        }
+
+        bits -= wasted_bits;
+        Status status = Status::OK;
+
+        if (type == 0) {
+            // Constant, digital silence mostly
+            std::fill(output, output + block_size, reader.read_signed(bits));
+        } else if (type == 1) {
+            for (uint32_t i = 0; i < block_size; ++i) {
+                output[i] = reader.read_signed(bits);
+            }
+        } else if (type >= 8 && type <= 12) {
+            status = decode_fixed(reader, bits, type - 8, output);
+        } else if (type >= 32) {
+            status = decode_lpc(reader, bits, type - 31, output);
+        } else {
+            return reader.overrun() ? Status::INCOMPLETE : Status::INVALID;
+        }
+
+        if (reader.overrun()) {
+            return Status::INCOMPLETE;
+        }
+
+        if (status == Status::OK && wasted_bits > 0) {
+            for (uint32_t i = 0; i < block_size; ++i) {
+                output[i] = static_cast<int32_t>(static_cast<uint32_t>(output[i]) << wasted_bits);
+            }
+        }
+
+        return status;
+    }
+
+    Status decode_fixed(BitReader& reader, int bits, uint32_t order, int32_t* output)
+    {
+        if (order > _header.block_size) {
+            return Status::INVALID;
+        }
+
+        for (uint32_t i = 0; i < order; ++i) {
+            output[i] = reader.read_signed(bits);
+        }
+
+        Status status = decode_residual(reader, order, output);
+        if (status != Status::OK) {
+            return status;
+        }
+
+        // Up to 24 + 1 bits with coefficients summing to 16 still fit
+        int32_t* s = output;
+        for (uint32_t i = order; i < _header.block_size; ++i) {
+            switch (order) {
+                case 1: s[i] += s[i - 1]; break;
+                case 2: s[i] += 2 * s[i - 1] - s[i - 2]; break;
+                case 3: s[i] += 3 * (s[i - 1] - s[i - 2]) + s[i - 3]; break;
+                case 4: s[i] += 4 * (s[i - 1] + s[i - 3]) - 6 * s[i - 2] - s[i - 4]; break;
+            }
+        }
+
+        return Status::OK;
+    }
+
+    Status decode_lpc(BitReader& reader, int bits, uint32_t order, int32_t* output)
+    {
+        if (order > _header.block_size) {
+            return Status::INVALID;
+        }
+
+        for (uint32_t i = 0; i < order; ++i) {
+            output[i] = reader.read_signed(bits);
+        }
+
+        int precision = reader.read(4) + 1;
+        int shift = reader.read_signed(5);
+        if (precision == 16 || shift < 0) {
+            return reader.overrun() ? Status::INCOMPLETE : Status::INVALID;
+        }
+
+        int32_t coefficients[MAX_LPC_ORDER];
+        for (uint32_t i = 0; i < order; ++i) {
+            coefficients[i] = reader.read_signed(precision);
+        }
+
+        Status status = decode_residual(reader, order, output);
+        if (status != Status::OK) {
+            return status;
+        }
+
+        // 32-bit sums are enough for 16-bit audio and much faster in wasm
+        int order_bits = 32 - __builtin_clz(order);
+        if (bits + precision + order_bits <= 32) {
+            for (uint32_t i = order; i < _header.block_size; ++i) {
+                int32_t sum = 0;
+                for (uint32_t j = 0; j < order; ++j) {
+                    sum += coefficients[j] * output[i - j - 1];
+                }
+                output[i] += sum >> shift;
+            }
+        } else {
+            for (uint32_t i = order; i < _header.block_size; ++i) {
+                int64_t sum = 0;
+                for (uint32_t j = 0; j < order; ++j) {
+                    sum += static_cast<int64_t>(coefficients[j]) * output[i - j - 1];
+                }
+                output[i] += static_cast<int32_t>(sum >> shift);
+            }
+        }
+
+        return Status::OK;
+    }
+
+    /* Partitioned Rice coded residual, after `order` warm-up samples */
+    Status decode_residual(BitReader& reader, uint32_t order, int32_t* output)
+    {
+        uint32_t method = reader.read(2);
+        if (method > 1) {
+            return reader.overrun() ? Status::INCOMPLETE : Status::INVALID;
+        }
+
+        int parameter_bits = method == 0 ? 4 : 5;
+        uint32_t escape = method == 0 ? 15 : 31;
+        uint32_t partition_order = reader.read(4);
+        uint32_t partition_samples = _header.block_size >> partition_order;
+
+        if ((partition_samples << partition_order) != _header.block_size
+            || partition_samples < order) {
+            return reader.overrun() ? Status::INCOMPLETE : Status::INVALID;
+        }
+
+        int32_t* sample = output + order;
+        for (uint32_t partition = 0; partition < (1u << partition_order); ++partition) {
+            uint32_t count = partition_samples - (partition == 0 ? order : 0);
+            uint32_t parameter = reader.read(parameter_bits);
+
+            if (parameter == escape) {
+                int bits = reader.read(5);
+                for (uint32_t i = 0; i < count; ++i) {
+                    *sample++ = reader.read_signed(bits);
+                }
+            } else {
+                for (uint32_t i = 0; i < count; ++i) {
+                    uint32_t value = (reader.read_unary() << parameter) | reader.read(parameter);
+                    *sample++ = static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+                }
+            }
+
+            // Garbage can make the loops above very long, give up early
+            if (reader.overrun()) {
+                return Status::INCOMPLETE;
+            }
+        }
+
+        return Status::OK;
+    }
+
+    void decorrelate()
+    {
+        int32_t* left = _buffers[0].get();
+        int32_t* right = _buffers[1].get();
+
+        switch (_header.assignment) {
+            case LEFT_SIDE:
+                for (uint32_t i = 0; i < _header.block_size; ++i) {
+                    right[i] = left[i] - right[i];
+                }
+                break;
+            case SIDE_RIGHT:
+                for (uint32_t i = 0; i < _header.block_size; ++i) {
+                    left[i] += right[i];
+                }
+                break;
+            case MID_SIDE:
+                for (uint32_t i = 0; i < _header.block_size; ++i) {
+                    int32_t side = right[i];
+                    int32_t mid = static_cast<int32_t>(static_cast<uint32_t>(left[i]) << 1) | (side & 1);
+                    left[i] = (mid + side) >> 1;
+                    right[i] = (mid - side) >> 1;
+                }
+                break;
+        }
+    }
+
+    void convert_to_stereo(uint32_t first, uint32_t count)
+    {
+        const int32_t* left = _buffers[0].get() + first;
+        const int32_t* right = _buffers[_header.channels > 1 ? 1 : 0].get() + first;
+        int16_t* output = _output.get();
+        int bits = _header.bits_per_sample;
+
+        if (bits >= 16) {
+            for (uint32_t i = 0; i < count; ++i) {
+                output[2 * i] = static_cast<int16_t>(left[i] >> (bits - 16));
+                output[2 * i + 1] = static_cast<int16_t>(right[i] >> (bits - 16));
+            }
+        } else {
+            for (uint32_t i = 0; i < count; ++i) {
+                output[2 * i] = static_cast<int16_t>(left[i] * (1 << (16 - bits)));
+                output[2 * i + 1] = static_cast<int16_t>(right[i] * (1 << (16 - bits)));
+            }
+        }
+    }
+};
+
+
+FlacStreamDecoder::FlacStreamDecoder(StemStorage::Writer& writer)
+    : _writer(writer)
+{
+}
+
+FlacStreamDecoder::~FlacStreamDecoder() = default;
+
+bool FlacStreamDecoder::feed(const uint8_t* data, size_t bytes)
+{
+    using Status = FrameDecoder::Status;
+
+    _pending.insert(_pending.end(), data, data + bytes);
+    size_t consumed = 0;
+
+    if (!_decoder) {
+        FrameDecoder::stream_info info;
+        Status status = FrameDecoder::parse_stream_info(
+            _pending.data(), _pending.size(), info, consumed);
+
+        if (status != Status::OK) {
+            return status == Status::INCOMPLETE;
+        }
+
+        _decoder = std::make_unique<FrameDecoder>(info);
+    }
+
+    while (!_writer.complete()) {
+        size_t used = 0;
+        Status status = _decoder->decode_frame(
+            _pending.data() + consumed, _pending.size() - consumed, used);
+
+        if (status == Status::INCOMPLETE) {
+            break;
+        }
+
+        // Frames follow each other without gaps
+        if (status == Status::INVALID || _decoder->first_sample() != _writer.position()) {
+            _pending.clear();
+            return false;
+        }
+
+        consumed += used;
+        _decoder->append(_writer, 0);
+    }
+
+    // What's left is a partial frame, usually a few kB
+    _pending.erase(_pending.begin(), _pending.begin() + consumed);
+    return true;
+}
+
+bool FlacStreamDecoder::finish()
+{
+    _pending.clear();
+    return _writer.complete();
+}
+
+bool FlacStreamDecoder::decode_range(const uint8_t* data, size_t bytes,
+    StemStorage::Writer& writer, const std::atomic_bool& cancelled)
+{
+    using Status = FrameDecoder::Status;
+
+    FrameDecoder::stream_info info;
+    size_t header_bytes = 0;
+    if (FrameDecoder::parse_stream_info(data, bytes, info, header_bytes) != Status::OK) {
+        return false;
+    }
+
+    // Bisect the file for a frame that starts at or before the position,
+    // the last few frames before it are decoded and dropped
+    FrameDecoder decoder(info);
+    uint32_t position = writer.position();
+    size_t low = header_bytes;
+    size_t high = bytes;
+
+    while (high - low > BISECT_MIN_BYTES) {
+        size_t middle = low + (high - low) / 2;
+        size_t offset = 0;
+
+        if (decoder.find_frame(data, bytes, middle, offset) && decoder.first_sample() <= position) {
+            low = offset;
+        } else {
+            high = middle;
+        }
+    }
+
+    size_t offset = low;
+    while (!writer.complete() && !cancelled) {
+        size_t used = 0;
+        if (decoder.decode_frame(data + offset, bytes - offset, used) != Status::OK) {
+            break;
+        }
+
+        offset += used;
+        uint64_t first = decoder.first_sample();
+        if (first > writer.position()) {
+            break; // frames are missing
+        }
+
+        if (first + decoder.block_size() > writer.position()) {
+            decoder.append(writer, writer.position() - first);
+        }
+    }
+
+    return writer.complete();
+}
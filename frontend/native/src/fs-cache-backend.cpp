@@ -0,0 +1,138 @@
+#include <fs-cache-backend.h>
+
+#include <emscripten.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <system_error>
+
+
+const char* FsCacheBackend::TEMP_SUFFIX = ".tmp";
+const int FsCacheBackend::SYNC_DELAY_MS = 2000;
+
+FsCacheBackend::FsCacheBackend(std::string directory, bool sync_idbfs)
+    : _directory(std::move(directory))
+    , _sync_idbfs(sync_idbfs)
+{
+}
+
+auto FsCacheBackend::list() -> std::vector<blob>
+{
+    std::vector<blob> blobs;
+    std::error_code error;
+    std::filesystem::directory_iterator file(_directory, error);
+
+    for (; !error && file != std::filesystem::directory_iterator(); file.increment(error)) {
+        if (!file->is_regular_file(error)) {
+            continue;
+        }
+
+        std::string name = file->path().filename().string();
+        if (name.ends_with(TEMP_SUFFIX)) {
+            // Left behind by a write that never finished
+            std::filesystem::remove(file->path(), error);
+            continue;
+        }
+
+        blobs.push_back({
+            .name = name,
+            .bytes = file->file_size(error),
+        });
+    }
+
+    return blobs;
+}
+
+bool FsCacheBackend::read(const std::string& name, std::vector<uint8_t>& data)
+{
+    std::string path = path_of(name);
+    std::error_code error;
+    uint64_t bytes = std::filesystem::file_size(path, error);
+    if (error) {
+        return false;
+    }
+
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    data.resize(bytes);
+    bool read_ok = fread(data.data(), 1, bytes, file) == bytes;
+    fclose(file);
+
+    return read_ok;
+}
+
+bool FsCacheBackend::write(const std::string& name, const uint8_t* data, size_t bytes)
+{
+    // Written aside and renamed, so that the blob is never seen half-written
+    std::string path = path_of(name);
+    std::string temp_path = path + TEMP_SUFFIX;
+
+    FILE* file = fopen(temp_path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    bool written_ok = fwrite(data, 1, bytes, file) == bytes;
+    written_ok = fclose(file) == 0 && written_ok;
+
+    std::error_code error;
+    if (written_ok) {
+        std::filesystem::rename(temp_path, path, error);
+    }
+
+    if (!written_ok || error) {
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+
+    return true;
+}
+
+void FsCacheBackend::remove(const std::string& name)
+{
+    std::error_code error;
+    std::filesystem::remove(path_of(name), error);
+}
+
+void FsCacheBackend::flush()
+{
+    if (!_sync_idbfs) {
+        return;
+    }
+
+    // A sync writes back every change in the mount. It starts a while after
+    // the first flush, the ones requested until it's done are merged into it
+    // or into a single next one.
+    MAIN_THREAD_ASYNC_EM_ASM({
+        const delayMs = $0;
+        const sync = () => {
+            Module._stemCacheSync = 'running';
+            FS.syncfs(false, (err) => {
+                if (err) {
+                    console.warn('Could not persist the stem cache:', err);
+                }
+
+                const again = Module._stemCacheSync === 'pending';
+                Module._stemCacheSync = again ? 'scheduled' : undefined;
+                if (again) {
+                    setTimeout(sync, delayMs);
+                }
+            });
+        };
+
+        if (Module._stemCacheSync === 'running') {
+            Module._stemCacheSync = 'pending';
+        } else if (!Module._stemCacheSync) {
+            Module._stemCacheSync = 'scheduled';
+            setTimeout(sync, delayMs);
+        }
+    }, SYNC_DELAY_MS);
+}
+
+std::string FsCacheBackend::path_of(const std::string& name) const
+{
+    return _directory + "/" + name;
+}
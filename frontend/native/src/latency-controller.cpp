@@ -0,0 +1,157 @@
+#include <latency-controller.h>
+
+#include <audio-buffer.h>
+
+#include <algorithm>
+
+
+const int LatencyController::WINDOW_CHUNKS = AUDIO_SAMPLE_RATE / AUDIO_CHUNK_SAMPLES; // ~1s
+const int LatencyController::HEADROOM_CHUNKS = 2;
+const int LatencyController::STABLE_WINDOWS_TO_SHRINK = 10;
+const int LatencyController::STABLE_WINDOWS_TO_LOWER_FLOOR = 60;
+const int LatencyController::MAX_WINDOWS_TO_LOWER_FLOOR = 60 * 60;
+const double LatencyController::LOW_PERCENTILE = 0.01;
+
+LatencyController::LatencyController(AudioBuffer& buffer)
+    : _buffer(buffer)
+    , _min_chunks(1)
+    , _max_chunks(buffer.capacity() / AUDIO_CHUNK_SAMPLES)
+    , _fill_histogram(buffer.capacity() / AUDIO_CHUNK_SAMPLES + 1, 0)
+    , _window_position(0)
+    , _stable_windows(0)
+    , _floor_windows(0)
+    , _floor_hold_windows(STABLE_WINDOWS_TO_LOWER_FLOOR)
+    , _floor_chunks(0)
+    , _last_underflows(buffer.underflow_count())
+    , _last_epoch(buffer.epoch())
+{
+}
+
+void LatencyController::set_bounds(uint32_t min_samples, uint32_t max_samples)
+{
+    uint32_t capacity = _buffer.capacity() / AUDIO_CHUNK_SAMPLES;
+    uint32_t min_chunks = std::clamp<uint32_t>(min_samples / AUDIO_CHUNK_SAMPLES, 1, capacity);
+    uint32_t max_chunks = std::clamp<uint32_t>(max_samples / AUDIO_CHUNK_SAMPLES, min_chunks, capacity);
+
+    _min_chunks = min_chunks;
+    _max_chunks = max_chunks;
+
+    // Make sure the current target obeys new bounds right away
+    set_target_chunks(_buffer.target_size() / AUDIO_CHUNK_SAMPLES);
+}
+
+uint32_t LatencyController::min_latency_samples() const
+{
+    return _min_chunks * AUDIO_CHUNK_SAMPLES;
+}
+
+uint32_t LatencyController::max_latency_samples() const
+{
+    return _max_chunks * AUDIO_CHUNK_SAMPLES;
+}
+
+uint32_t LatencyController::target_latency_samples() const
+{
+    return _buffer.target_size();
+}
+
+void LatencyController::process()
+{
+    uint32_t read_fill = _buffer.take_low_read_fill();
+    if (read_fill == AudioBuffer::NO_READS) {
+        return;
+    }
+
+    // Chunks that were still left once the reader took one, 0 is a near miss
+    uint32_t headroom = read_fill > 0 ? read_fill - 1 : 0;
+    headroom = std::min<uint32_t>(headroom, _fill_histogram.size() - 1);
+    ++_fill_histogram[headroom];
+
+    if (++_window_position >= WINDOW_CHUNKS) {
+        evaluate_window();
+
+        _window_position = 0;
+        std::fill(_fill_histogram.begin(), _fill_histogram.end(), 0);
+    }
+}
+
+void LatencyController::evaluate_window()
+{
+    int underflows = _buffer.underflow_count();
+    int underflow_delta = underflows - _last_underflows;
+    _last_underflows = underflows;
+
+    uint32_t epoch = _buffer.epoch();
+    bool buffer_was_reset = epoch != _last_epoch;
+    _last_epoch = epoch;
+
+    uint32_t target = _buffer.target_size() / AUDIO_CHUNK_SAMPLES;
+
+    if (underflow_delta > 0) {
+        // We can't keep up - grow quickly, and don't come back here soon
+        if (_floor_chunks > 0 && target <= _floor_chunks + 1) {
+            _floor_hold_windows = std::min(_floor_hold_windows * 2, MAX_WINDOWS_TO_LOWER_FLOOR);
+        }
+
+        _stable_windows = 0;
+        _floor_windows = 0;
+        _floor_chunks = std::max(_floor_chunks, target);
+        set_target_chunks(target + std::max<uint32_t>(1, target / 2));
+        return;
+    }
+
+    if (_floor_chunks > 0 && ++_floor_windows >= _floor_hold_windows) {
+        // Conditions may have improved since (e.g. a background tab is back)
+        _floor_windows = 0;
+        --_floor_chunks;
+    }
+
+    if (buffer_was_reset) {
+        // Fill levels are meaningless while the buffer is being refilled
+        return;
+    }
+
+    uint32_t low_fill = low_fill_percentile();
+    if (low_fill == 0) {
+        // Almost underflowed - grow a bit
+        _stable_windows = 0;
+        _floor_windows = 0;
+        set_target_chunks(target + 1);
+    } else if (low_fill >= HEADROOM_CHUNKS) {
+        if (++_stable_windows >= STABLE_WINDOWS_TO_SHRINK && target - 1 > _floor_chunks) {
+            _stable_windows = 0;
+            set_target_chunks(target - 1);
+        }
+    } else {
+        _stable_windows = 0;
+    }
+}
+
+uint32_t LatencyController::low_fill_percentile() const
+{
+    uint32_t total = 0;
+    for (uint32_t count : _fill_histogram) {
+        total += count;
+    }
+
+    uint32_t threshold = static_cast<uint32_t>(total * LOW_PERCENTILE);
+    uint32_t cumulative = 0;
+    for (size_t fill = 0; fill < _fill_histogram.size(); ++fill) {
+        cumulative += _fill_histogram[fill];
+        if (cumulative > threshold) {
+            return fill;
+        }
+    }
+
+    return _fill_histogram.size() - 1;
+}
+
+void LatencyController::set_target_chunks(uint32_t chunks)
+{
+    chunks = std::clamp<uint32_t>(chunks, _min_chunks, _max_chunks);
+    uint32_t current = _buffer.target_size() / AUDIO_CHUNK_SAMPLES;
+
+    if (chunks != current) {
+        _buffer.set_target_size(chunks * AUDIO_CHUNK_SAMPLES);
+    }
+}
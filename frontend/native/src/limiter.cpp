@@ -79,7 +79,7 @@ double Limiter::reduction_db() const
     return _reduction_db;
 }
 
-void Limiter::apply(audio_chunk& chunk)
+void Limiter::apply(const audio_span& block)
 {
     limiter_settings settings = {
         .attack = _attack_ms,
@@ -91,9 +91,9 @@ void Limiter::apply(audio_chunk& chunk)
         .threshold = _threshold_db,
     };
 
-    for (int i = 0; i < AUDIO_CHUNK_SAMPLES; ++i) {
-        process_sample(settings, chunk.left_channel[i], _current_peak_l, _current_reduction_l);
-        process_sample(settings, chunk.right_channel[i], _current_peak_r, _current_reduction_r);
+    for (int i = 0; i < block.frames; ++i) {
+        process_sample(settings, block.left_channel[i], _current_peak_l, _current_reduction_l);
+        process_sample(settings, block.right_channel[i], _current_peak_r, _current_reduction_r);
     }
 
     _reduction_db = std::min(_current_reduction_l, _current_reduction_r);
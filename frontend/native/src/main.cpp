@@ -1,13 +1,24 @@
 #include <audio-buffer.h>
 #include <audio-worklet.h>
+#include <fs-cache-backend.h>
 #include <mixer.h>
+#include <performance-monitor.h>
+#include <stem-cache.h>
 
 #include <emscripten.h>
 
+#include <filesystem>
 #include <iostream>
 #include <memory>
 
-#define AUDIO_BUFFER_SIZE 2048
+#define AUDIO_BUFFER_MIN_SIZE 384
+#define AUDIO_BUFFER_INITIAL_SIZE 2048
+#define AUDIO_BUFFER_MAX_SIZE 8192
+#define RENDER_BLOCK_SIZE 512
+#define STEM_CACHE_DIRECTORY "/stem-cache"
+#define STEM_CACHE_SIZE_MB 256 // all of it is loaded into memory on startup
+#define DECODED_STEM_CACHE_DIRECTORY STEM_CACHE_DIRECTORY "/decoded" // synced along
+#define DECODED_STEM_CACHE_SIZE_MB 256
 
 std::unique_ptr<AudioWorklet> g_worklet;
 std::unique_ptr<Mixer> g_mixer;
@@ -16,20 +27,51 @@ int main() {
     std::cout.sync_with_stdio();
     std::cout << "WASM module is initializing..." << std::endl;
 
-    // Create audio buffer
-    std::shared_ptr<AudioBuffer> buffer = std::make_unique<AudioBuffer>(AUDIO_BUFFER_SIZE);
+    // Create audio buffer (its effective size is adjusted by the mixer at runtime)
+    std::shared_ptr<AudioBuffer> buffer = std::make_unique<AudioBuffer>(AUDIO_BUFFER_MAX_SIZE);
+    buffer->set_target_size(AUDIO_BUFFER_INITIAL_SIZE);
 
     // Create audio worklet
     g_worklet = std::make_unique<AudioWorklet>();
+    int output_sample_rate = g_worklet->sample_rate();
+
+    // Create performance monitor (shared by both audio threads)
+    std::shared_ptr<PerformanceMonitor> monitor = std::make_shared<PerformanceMonitor>(
+        buffer->capacity(), output_sample_rate);
+
     g_worklet->set_audio_buffer(buffer);
+    g_worklet->set_performance_monitor(monitor);
 
     // Create mixer
-    g_mixer = std::make_unique<Mixer>(buffer);
+    g_mixer = std::make_unique<Mixer>(buffer, monitor, output_sample_rate);
+    g_mixer->set_output_latency_bounds(AUDIO_BUFFER_MIN_SIZE, AUDIO_BUFFER_MAX_SIZE);
+    g_mixer->set_render_block_size(RENDER_BLOCK_SIZE);
+    g_worklet->set_mixer(g_mixer.get());
+
+    // Stems cached by previous sessions are loaded from IndexedDB before
+    // the JS side learns that the module is ready and adds any stems
+    EM_ASM({
+        const initialized = (cacheLoaded) => {
+            if (cacheLoaded)
+                Module.attachStemCache();
+            if (window._wasmInitialized)
+                window._wasmInitialized();
+        };
 
-    EM_ASM({ 
-        if (window._wasmInitialized)
-            window._wasmInitialized();
-    });
+        try {
+            const directory = UTF8ToString($0);
+            FS.mkdir(directory);
+            FS.mount(IDBFS, {}, directory);
+            FS.syncfs(true, (err) => {
+                if (err)
+                    console.warn('Stem cache is unavailable:', err);
+                initialized(!err);
+            });
+        } catch (err) {
+            console.warn('Stem cache is unavailable:', err);
+            initialized(false);
+        }
+    }, STEM_CACHE_DIRECTORY);
     
     std::cout << "WASM module has been initialized!" << std::endl;
     return 0;
@@ -39,3 +81,23 @@ Mixer* get_global_mixer()
 {
     return g_mixer.get();
 }
+
+void attach_stem_cache()
+{
+    std::error_code error;
+    std::filesystem::create_directory(DECODED_STEM_CACHE_DIRECTORY, error);
+
+    auto files = std::make_unique<FsCacheBackend>(STEM_CACHE_DIRECTORY, true);
+    auto decoded = std::make_unique<FsCacheBackend>(DECODED_STEM_CACHE_DIRECTORY, true);
+
+    g_mixer->set_stem_cache(
+        std::make_shared<StemCache>(
+            std::move(files), static_cast<uint64_t>(STEM_CACHE_SIZE_MB) * 1024 * 1024),
+        std::make_shared<StemCache>(
+            std::move(decoded), static_cast<uint64_t>(DECODED_STEM_CACHE_SIZE_MB) * 1024 * 1024));
+}
+
+uintptr_t get_audible_clock_address()
+{
+    return g_worklet->audible_clock().address();
+}
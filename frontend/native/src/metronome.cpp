@@ -25,11 +25,11 @@ double Metronome::gain() const
     return _gain;
 }
 
-void Metronome::process(uint32_t first_sample)
+void Metronome::process(uint32_t first_sample, int frames)
 {
     auto old_position = _tempo.current_position(first_sample + TICK_OFFSET - 1);
 
-    for (int i = 0; i < AUDIO_CHUNK_SAMPLES; ++i) {
+    for (int i = 0; i < frames; ++i) {
         uint32_t sample = first_sample + i + TICK_OFFSET;
         auto new_position = _tempo.current_position(sample);
         new_position.tick = old_position.tick;
@@ -54,13 +54,13 @@ void Metronome::process(uint32_t first_sample)
     }
 }
 
-void Metronome::render(audio_chunk& chunk)
+void Metronome::render(const audio_span& block)
 {
-    for (int i = 0; i < AUDIO_CHUNK_SAMPLES; ++i) {
+    for (int i = 0; i < block.frames; ++i) {
         if (_sample_position < _current_sample_length) {
             float sample_value = _current_sample[_sample_position++] / 32768.0 * _gain;
-            chunk.left_channel[i] += sample_value;
-            chunk.right_channel[i] += sample_value;
+            block.left_channel[i] += sample_value;
+            block.right_channel[i] += sample_value;
         }
     }
 }
@@ -0,0 +1,112 @@
+#include <mix-kernels.h>
+
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+
+
+auto MixKernels::select(bool mono, float gain_l, float gain_r) -> Kernel
+{
+    if (gain_l == 0.f && gain_r == 0.f) {
+        return nullptr;
+    }
+
+    if (gain_l == UNITY_GAIN && gain_r == UNITY_GAIN) {
+        return mono 
+            ? &MixKernels::accumulate<true, GainMode::UNITY> 
+            : &MixKernels::accumulate<false, GainMode::UNITY>;
+    }
+
+    if (gain_l == gain_r) {
+        return mono 
+            ? &MixKernels::accumulate<true, GainMode::CENTERED> 
+            : &MixKernels::accumulate<false, GainMode::CENTERED>;
+    }
+
+    return mono 
+        ? &MixKernels::accumulate<true, GainMode::GENERIC> 
+        : &MixKernels::accumulate<false, GainMode::GENERIC>;
+}
+
+void MixKernels::accumulate_stereo(const int16_t* source, int frames,
+    float gain_l, float gain_r, float* left, float* right)
+{
+    accumulate<false, GainMode::GENERIC>(source, frames, gain_l, gain_r, left, right);
+}
+
+const char* MixKernels::variant()
+{
+#ifdef __wasm_simd128__
+    return "simd128";
+#else
+    return "scalar";
+#endif
+}
+
+template <bool mono, MixKernels::GainMode mode>
+void MixKernels::accumulate(const int16_t* source, int frames,
+    float gain_l, float gain_r, float* left, float* right)
+{
+    if constexpr (mode == GainMode::UNITY) {
+        gain_l = gain_r = UNITY_GAIN;
+    } else if constexpr (mode == GainMode::CENTERED) {
+        gain_r = gain_l;
+    }
+
+    // A mono source with equal gains gives the same signal in both channels
+    constexpr bool shared_channel = mono && mode != GainMode::GENERIC;
+
+    int i = 0;
+
+#ifdef __wasm_simd128__
+    const v128_t gain_l_vec = wasm_f32x4_splat(gain_l);
+    const v128_t gain_r_vec = wasm_f32x4_splat(gain_r);
+
+    // 8 frames (16 samples) per iteration
+    for (; i + 8 <= frames; i += 8) {
+        v128_t first = wasm_v128_load(source + 2 * i);      // L0 R0 L1 R1 L2 R2 L3 R3
+        v128_t second = wasm_v128_load(source + 2 * i + 8); // L4 R4 L5 R5 L6 R6 L7 R7
+
+        v128_t left_16 = wasm_i16x8_shuffle(first, second, 0, 2, 4, 6, 8, 10, 12, 14);
+        v128_t left_low = wasm_f32x4_convert_i32x4(wasm_i32x4_extend_low_i16x8(left_16));
+        v128_t left_high = wasm_f32x4_convert_i32x4(wasm_i32x4_extend_high_i16x8(left_16));
+        left_low = wasm_f32x4_mul(left_low, gain_l_vec);
+        left_high = wasm_f32x4_mul(left_high, gain_l_vec);
+
+        v128_t right_low, right_high;
+        if constexpr (shared_channel) {
+            right_low = left_low;
+            right_high = left_high;
+        } else if constexpr (mono) {
+            right_low = wasm_f32x4_convert_i32x4(wasm_i32x4_extend_low_i16x8(left_16));
+            right_high = wasm_f32x4_convert_i32x4(wasm_i32x4_extend_high_i16x8(left_16));
+            right_low = wasm_f32x4_mul(right_low, gain_r_vec);
+            right_high = wasm_f32x4_mul(right_high, gain_r_vec);
+        } else {
+            v128_t right_16 = wasm_i16x8_shuffle(first, second, 1, 3, 5, 7, 9, 11, 13, 15);
+            right_low = wasm_f32x4_convert_i32x4(wasm_i32x4_extend_low_i16x8(right_16));
+            right_high = wasm_f32x4_convert_i32x4(wasm_i32x4_extend_high_i16x8(right_16));
+            right_low = wasm_f32x4_mul(right_low, gain_r_vec);
+            right_high = wasm_f32x4_mul(right_high, gain_r_vec);
+        }
+
+        wasm_v128_store(left + i, wasm_f32x4_add(wasm_v128_load(left + i), left_low));
+        wasm_v128_store(left + i + 4, wasm_f32x4_add(wasm_v128_load(left + i + 4), left_high));
+        wasm_v128_store(right + i, wasm_f32x4_add(wasm_v128_load(right + i), right_low));
+        wasm_v128_store(right + i + 4, wasm_f32x4_add(wasm_v128_load(right + i + 4), right_high));
+    }
+#endif
+
+    for (; i < frames; ++i) {
+        float left_sample = source[2 * i] * gain_l;
+        left[i] += left_sample;
+
+        if constexpr (shared_channel) {
+            right[i] += left_sample;
+        } else if constexpr (mono) {
+            right[i] += source[2 * i] * gain_r;
+        } else {
+            right[i] += source[2 * i + 1] * gain_r;
+        }
+    }
+}
@@ -1,32 +1,59 @@
 #include <mixer.h>
 
 #include <audio-buffer.h>
+#include <latency-controller.h>
 #include <limiter.h>
 #include <metronome.h>
+#include <output-stage.h>
 #include <peak-meter.h>
+#include <realtime-check.h>
+#include <resampler.h>
 #include <utils.h>
 
 #include <emscripten.h>
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstring>
 #include <iostream>
 
 #define UNDERFLOW_COUNTDOWN_INITIAL_VALUE 1000
+#define DIRECT_MODE_POLL_INTERVAL std::chrono::milliseconds(10)
+#define SOFT_FADE_SAMPLES AUDIO_CHUNK_SAMPLES
 
-Mixer::Mixer(std::shared_ptr<AudioBuffer> out_buffer)
+Mixer::Mixer(
+    std::shared_ptr<AudioBuffer> out_buffer, 
+    std::shared_ptr<PerformanceMonitor> monitor, 
+    int output_sample_rate)
     : _buffer(std::move(out_buffer))
+    , _monitor(std::move(monitor))
     , _state(PlaybackState::STOPPED)
     , _last_state(PlaybackState::STOPPED)
     , _playback_position(0)
     , _last_playback_position(0)
     , _length(0)
+    , _direct_rendering(false)
     , _tempo(std::make_unique<Tempo>())
     , _master_level(std::make_unique<PeakMeter>())
     , _metronome(std::make_unique<Metronome>(*_tempo))
     , _metronome_enabled(false)
     , _metronome_gain_db(1.0)
     , _limiter(std::make_unique<Limiter>())
-{
+    , _output_stage(std::make_unique<OutputStage>())
+    , _latency(std::make_unique<LatencyController>(*_buffer))
+    , _resampler(std::make_unique<Resampler>(AUDIO_SAMPLE_RATE, output_sample_rate))
+    , _render_block_size(AUDIO_CHUNK_SAMPLES)
+    , _master_block(std::make_unique<audio_block>())
+    , _master_frames(0)
+    , _master_read(0)
+    , _master_stamp{ .position = 0, .playing = false }
+{
+    if (!_resampler->bypass()) {
+        std::cout << "[MIXER] Resampling from " << AUDIO_SAMPLE_RATE 
+                  << " Hz to " << output_sample_rate << " Hz" << std::endl;
+    }
+
     _stems.set_bg_task_complete_callback(
         std::bind(&Mixer::invalidate_state, this));
 
@@ -67,6 +94,7 @@ void Mixer::stop()
     _state = PlaybackState::STOPPED;
     reset_playback();
     _buffer->clear();
+    reset_render_state();
 }
 
 std::string Mixer::playback_state() const
@@ -84,6 +112,7 @@ std::string Mixer::playback_state() const
 void Mixer::reset_playback()
 {
     _playback_position.store(0, std::memory_order_relaxed);
+    _stems.set_playhead(0);
     invalidate_state();
 }
 
@@ -97,10 +126,16 @@ song_position Mixer::playback_position_bst() const
     return _tempo->current_position(playback_position());
 }
 
+song_position Mixer::song_position_at(uint32_t sample) const
+{
+    return _tempo->current_position(sample);
+}
+
 bool Mixer::set_playback_position(uint32_t new_position)
 {
     if (_state != PlaybackState::STOPPED) {
         _playback_position.store(new_position, std::memory_order_relaxed);
+        _stems.set_playhead(new_position);
         return true;
     }
 
@@ -117,6 +152,11 @@ int Mixer::sample_rate() const
     return AUDIO_SAMPLE_RATE;
 }
 
+int Mixer::output_sample_rate() const
+{
+    return _resampler->output_rate();
+}
+
 void Mixer::set_metronome_enabled(bool enabled)
 {
     if (enabled != _metronome_enabled) {
@@ -243,11 +283,155 @@ bool Mixer::stem_soloed(uint32_t stem_id) const
     return _stems.stem_soloed(stem_id);
 }
 
+void Mixer::set_lazy_decoding(bool enabled)
+{
+    _stems.set_lazy_decoding(enabled);
+}
+
+bool Mixer::lazy_decoding() const
+{
+    return _stems.lazy_decoding();
+}
+
+void Mixer::set_pcm_cache_size_mb(int megabytes)
+{
+    _stems.set_pcm_cache_size(static_cast<size_t>(std::max(1, megabytes)) * 1024 * 1024);
+}
+
+int Mixer::pcm_cache_size_mb() const
+{
+    return _stems.pcm_cache_size() / (1024 * 1024);
+}
+
+void Mixer::set_stem_cache(std::shared_ptr<StemCache> files, std::shared_ptr<StemCache> decoded)
+{
+    _stems.set_stem_cache(std::move(files), std::move(decoded));
+}
+
+void Mixer::set_stem_cache_size_mb(int megabytes)
+{
+    _stems.set_stem_cache_size(static_cast<uint64_t>(std::max(1, megabytes)) * 1024 * 1024);
+}
+
+int Mixer::stem_cache_size_mb() const
+{
+    return _stems.stem_cache_size() / (1024 * 1024);
+}
+
+void Mixer::set_decoded_stem_cache_size_mb(int megabytes)
+{
+    _stems.set_decoded_stem_cache_size(static_cast<uint64_t>(std::max(1, megabytes)) * 1024 * 1024);
+}
+
+int Mixer::decoded_stem_cache_size_mb() const
+{
+    return _stems.decoded_stem_cache_size() / (1024 * 1024);
+}
+
+void Mixer::set_retained_stems_size_mb(int megabytes)
+{
+    _stems.set_retained_stems_size(static_cast<size_t>(std::max(0, megabytes)) * 1024 * 1024);
+}
+
+int Mixer::retained_stems_size_mb() const
+{
+    return _stems.retained_stems_size() / (1024 * 1024);
+}
+
 double Mixer::limiter_reduction_db() const
 {
     return _limiter->reduction_db();
 }
 
+void Mixer::set_output_trim_db(double trim_db)
+{
+    _output_stage->set_trim_db(trim_db);
+    invalidate_state();
+}
+
+double Mixer::output_trim_db() const
+{
+    return _output_stage->trim_db();
+}
+
+void Mixer::set_render_block_size(int frames)
+{
+    // Blocks are sliced into whole chunks, round to a multiple of the chunk size
+    frames = (frames + AUDIO_CHUNK_SAMPLES - 1) / AUDIO_CHUNK_SAMPLES * AUDIO_CHUNK_SAMPLES;
+    _render_block_size = std::clamp(frames, AUDIO_CHUNK_SAMPLES, AUDIO_MAX_BLOCK_SAMPLES);
+}
+
+int Mixer::render_block_size() const
+{
+    return _render_block_size;
+}
+
+void Mixer::set_output_latency_bounds(uint32_t min_samples, uint32_t max_samples)
+{
+    _latency->set_bounds(min_samples, max_samples);
+    invalidate_state();
+}
+
+uint32_t Mixer::output_latency() const
+{
+    return _latency->target_latency_samples();
+}
+
+performance_stats Mixer::collect_performance_stats() const
+{
+    auto stats = _monitor->snapshot();
+    stats.output_latency = direct_rendering() ? 0 : output_latency();
+
+    task_pool_stats tasks = _stems.task_stats();
+    stats.task_queue_depths = tasks.queued;
+    stats.task_queue_peak = tasks.peak_queued;
+    stats.tasks_running = tasks.running;
+    stats.tasks_completed = tasks.completed;
+    stats.tasks_cancelled = tasks.cancelled;
+    stats.tasks_coalesced = tasks.coalesced;
+    return stats;
+}
+
+void Mixer::set_direct_rendering(bool enabled)
+{
+    if (enabled != _direct_rendering) {
+        std::lock_guard lock(_mixdown_lock);
+        _direct_rendering = enabled;
+        _buffer->clear();
+        reset_render_state();
+
+        invalidate_state();
+    }
+}
+
+bool Mixer::direct_rendering() const
+{
+    return _direct_rendering.load(std::memory_order_relaxed);
+}
+
+chunk_stamp Mixer::render_direct(audio_chunk& chunk)
+{
+    // Called from the audio worklet - nothing here may block or allocate
+    RealtimeCheck::Scope realtime_scope;
+
+    // The main thread is changing the state right now, output silence
+    if (!_mixdown_lock.try_lock()) {
+        for (int i = 0; i < AUDIO_CHUNK_SAMPLES; ++i) {
+            chunk.left_channel[i] = 0;
+            chunk.right_channel[i] = 0;
+        }
+
+        return { .position = playback_position(), .playing = false };
+    }
+
+    double mixdown_start = emscripten_get_now();
+    chunk_stamp stamp = render_locked(chunk);
+    _monitor->record_mixdown(emscripten_get_now() - mixdown_start);
+
+    _mixdown_lock.unlock();
+    return stamp;
+}
+
 void Mixer::thread_main()
 {
     int last_underflows = _buffer->underflow_count();
@@ -256,15 +440,26 @@ void Mixer::thread_main()
     std::cout << "[MIXER] Audio processing thread started" << std::endl;
 
     while (true) {
-        audio_chunk chunk;
-        for (int i = 0; i < AUDIO_CHUNK_SAMPLES; ++i) {
-            chunk.left_channel[i] = 0;
-            chunk.right_channel[i] = 0;
+        // Render straight into the next free slot of the output buffer
+        audio_chunk& chunk = *_buffer->reserve_write();
+
+        if (_direct_rendering) {
+            // The worklet renders by itself, just watch for the end of the track.
+            // The reserved slot is left uncommitted and will be reused later.
+            std::this_thread::sleep_for(DIRECT_MODE_POLL_INTERVAL);
+
+            if (_playback_position > _length) {
+                stop();
+            }
+            continue;
         }
 
-        perform_mixdown(chunk);
+        double mixdown_start = emscripten_get_now();
+        chunk_stamp stamp = perform_mixdown(chunk);
+        _monitor->record_mixdown(emscripten_get_now() - mixdown_start);
 
-        (*_buffer) << chunk;
+        _latency->process();
+        _buffer->commit_write(stamp);
 
         if (_playback_position > _length) {
             stop();
@@ -283,23 +478,119 @@ void Mixer::thread_main()
     }
 }
 
-void Mixer::perform_mixdown(audio_chunk& chunk)
+chunk_stamp Mixer::perform_mixdown(audio_chunk& chunk)
 {
     std::lock_guard lock(_mixdown_lock);
+    return render_locked(chunk);
+}
+
+chunk_stamp Mixer::render_locked(audio_chunk& chunk)
+{
+    chunk_stamp stamp;
+
+    if (!_resampler->bypass()) {
+        stamp = resample_locked(chunk);
+    } else if (_master_read == _master_frames && render_block_frames() == AUDIO_CHUNK_SAMPLES) {
+        // Nothing to slice, mix straight into the output chunk
+        for (int i = 0; i < AUDIO_CHUNK_SAMPLES; ++i) {
+            chunk.left_channel[i] = 0;
+            chunk.right_channel[i] = 0;
+        }
+
+        stamp = mixdown_locked(chunk);
+    } else {
+        stamp = slice_locked(chunk);
+    }
+
+    // Trim and clip at the output sample rate, resampling may overshoot
+    _output_stage->apply(chunk);
+    return stamp;
+}
 
+chunk_stamp Mixer::slice_locked(audio_chunk& chunk)
+{
+    if (_master_read == _master_frames) {
+        mixdown_master_locked();
+    }
+
+    chunk_stamp stamp = _master_stamp;
+    if (stamp.playing) {
+        stamp.position += _master_read;
+    }
+
+    memcpy(chunk.left_channel, 
+        _master_block->left_channel + _master_read, sizeof(chunk.left_channel));
+    memcpy(chunk.right_channel, 
+        _master_block->right_channel + _master_read, sizeof(chunk.right_channel));
+    _master_read += AUDIO_CHUNK_SAMPLES;
+
+    return stamp;
+}
+
+chunk_stamp Mixer::resample_locked(audio_chunk& chunk)
+{
+    // The master bus runs at the song's sample rate. It is mixed down block
+    // by block for as long as the resampler needs more input.
+    if (_resampler->needs_input()) {
+        mixdown_master_locked();
+    }
+
+    // The stamp points at the first song sample that goes into this chunk
+    chunk_stamp stamp = _master_stamp;
+    if (stamp.playing) {
+        stamp.position += _resampler->input_offset();
+    }
+
+    int frames = _resampler->process(chunk, 0);
+    while (frames < AUDIO_CHUNK_SAMPLES) {
+        mixdown_master_locked();
+        frames += _resampler->process(chunk, frames);
+    }
+
+    return stamp;
+}
+
+int Mixer::render_block_frames() const
+{
+    // Large blocks would make the worklet's load uneven, keep it per quantum
+    return direct_rendering() ? AUDIO_CHUNK_SAMPLES : _render_block_size.load();
+}
+
+void Mixer::mixdown_master_locked()
+{
+    audio_span block(*_master_block, render_block_frames());
+    for (int i = 0; i < block.frames; ++i) {
+        block.left_channel[i] = 0;
+        block.right_channel[i] = 0;
+    }
+
+    _master_stamp = mixdown_locked(block);
+    _master_frames = block.frames;
+    _master_read = 0;
+
+    if (!_resampler->bypass()) {
+        _resampler->feed(block);
+    }
+}
+
+chunk_stamp Mixer::mixdown_locked(const audio_span& block)
+{
     uint32_t position = _playback_position;
     uint32_t original_position = position;
     PlaybackState state = _state;
 
+    // The audio worklet must not wait for the render pool
+    bool parallel = !direct_rendering();
+
     if (state == PlaybackState::PLAYING) {
-        _stems.render(position, chunk);
+        _stems.render(position, block, parallel);
         
         if (_metronome_enabled) {
             _metronome->set_gain(Utils::decibels_to_gain(_metronome_gain_db));
-            _metronome->process(position);
+            _metronome->process(position, block.frames);
         }
 
-        position += AUDIO_CHUNK_SAMPLES;
+        position += block.frames;
     }
     if (state == PlaybackState::STOPPED) {
         _master_level->reset();
@@ -308,45 +599,59 @@ void Mixer::perform_mixdown(audio_chunk& chunk)
     // This two routines should prevent audio clicking by performing
     // a fade-in or a fade-out respectively
     if (state == PlaybackState::PLAYING && _last_state == PlaybackState::PAUSED) {
-        apply_soft_start(chunk);
+        apply_soft_start(block);
     } else if (state == PlaybackState::PAUSED && _last_state == PlaybackState::PLAYING) {
         // render last frame to make a fade-out frame 
         // (state != PLAYING so it wasn't rendered yet)
-        _stems.render(_last_playback_position, chunk); 
+        _stems.render(_last_playback_position, block, parallel); 
 
-        apply_soft_stop(chunk);
+        apply_soft_stop(block);
     }
 
-    _master_level->process(chunk);
-    _metronome->render(chunk);
-    _limiter->apply(chunk);
+    _master_level->process(block);
+    _metronome->render(block);
+    _limiter->apply(block);
 
     _playback_position.compare_exchange_strong(
         original_position, position, std::memory_order::relaxed);
 
     _last_state = state;
     _last_playback_position = position;
+
+    return { .position = original_position, .playing = state == PlaybackState::PLAYING };
+}
+
+void Mixer::reset_render_state()
+{
+    // Drop everything that was rendered ahead of the output buffer
+    _resampler->reset();
+    _master_frames = 0;
+    _master_read = 0;
 }
 
-void Mixer::apply_soft_start(audio_chunk& chunk)
+void Mixer::apply_soft_start(const audio_span& block)
 {
-    for (int i = 0; i < AUDIO_CHUNK_SAMPLES; ++i) {
-        float factor = static_cast<float>(i) / AUDIO_CHUNK_SAMPLES;
+    int fade_frames = std::min(block.frames, SOFT_FADE_SAMPLES);
+
+    for (int i = 0; i < fade_frames; ++i) {
+        float factor = static_cast<float>(i) / fade_frames;
         factor *= factor;
 
-        chunk.left_channel[i] *= factor;
-        chunk.right_channel[i] *= factor;
+        block.left_channel[i] *= factor;
+        block.right_channel[i] *= factor;
     }
 }
 
-void Mixer::apply_soft_stop(audio_chunk& chunk)
+void Mixer::apply_soft_stop(const audio_span& block)
 {
-    for (int i = 0; i < AUDIO_CHUNK_SAMPLES; ++i) {
-        float factor = 1.f - static_cast<float>(i) / AUDIO_CHUNK_SAMPLES;
+    int fade_frames = std::min(block.frames, SOFT_FADE_SAMPLES);
+
+    for (int i = 0; i < block.frames; ++i) {
+        float factor = i < fade_frames ? 1.f - static_cast<float>(i) / fade_frames : 0.f;
         factor *= factor;
 
-        chunk.left_channel[i] *= factor;
-        chunk.right_channel[i] *= factor;
+        block.left_channel[i] *= factor;
+        block.right_channel[i] *= factor;
     }
 }
 
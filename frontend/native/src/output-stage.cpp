@@ -0,0 +1,75 @@
+#include <output-stage.h>
+
+#include <audio-buffer.h>
+#include <utils.h>
+
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+
+
+// Some system mixers (notably on Windows) apply their own limiting, 
+// especially when resampling. Leave them a bit of headroom (~0.85 gain).
+const double OutputStage::DEFAULT_TRIM_DB = -1.41;
+
+static void hard_clip(float* samples)
+{
+#ifdef __wasm_simd128__
+    const v128_t upper = wasm_f32x4_splat(1.f);
+    const v128_t lower = wasm_f32x4_splat(-1.f);
+
+    for (int i = 0; i < AUDIO_CHUNK_SAMPLES; i += 4) {
+        v128_t value = wasm_v128_load(samples + i);
+        value = wasm_f32x4_pmin(upper, wasm_f32x4_pmax(lower, value));
+        wasm_v128_store(samples + i, value);
+    }
+#else
+    for (int i = 0; i < AUDIO_CHUNK_SAMPLES; ++i) {
+        samples[i] = samples[i] > 1.f ? 1.f : (samples[i] < -1.f ? -1.f : samples[i]);
+    }
+#endif
+}
+
+OutputStage::OutputStage()
+    : _trim_db(DEFAULT_TRIM_DB)
+    , _trim_gain(Utils::decibels_to_gain(DEFAULT_TRIM_DB))
+    , _current_gain(_trim_gain)
+{
+}
+
+void OutputStage::set_trim_db(double trim_db)
+{
+    _trim_db = trim_db;
+    _trim_gain = Utils::decibels_to_gain(trim_db);
+}
+
+double OutputStage::trim_db() const
+{
+    return _trim_db;
+}
+
+void OutputStage::apply(audio_chunk& chunk)
+{
+    hard_clip(chunk.left_channel);
+    hard_clip(chunk.right_channel);
+
+    float target_gain = _trim_gain;
+
+    if (target_gain == _current_gain) {
+        for (int i = 0; i < AUDIO_CHUNK_SAMPLES; ++i) {
+            chunk.left_channel[i] *= target_gain;
+            chunk.right_channel[i] *= target_gain;
+        }
+    } else {
+        // Ramp over the whole chunk to avoid zipper noise
+        float step = (target_gain - _current_gain) / AUDIO_CHUNK_SAMPLES;
+
+        for (int i = 0; i < AUDIO_CHUNK_SAMPLES; ++i) {
+            float gain = _current_gain + step * (i + 1);
+            chunk.left_channel[i] *= gain;
+            chunk.right_channel[i] *= gain;
+        }
+
+        _current_gain = target_gain;
+    }
+}
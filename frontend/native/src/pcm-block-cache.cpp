@@ -0,0 +1,159 @@
+#include <pcm-block-cache.h>
+
+#include <stem-storage.h>
+
+#include <algorithm>
+#include <cstring>
+
+
+#define BLOCK_BYTES (PcmBlockCache::BLOCK_FRAMES * 2 * sizeof(int16_t))
+
+PcmBlockCache::PcmBlockCache(size_t capacity_bytes, const std::atomic<uint32_t>& reader_epoch)
+    : _capacity_blocks(0)
+    , _reader_epoch(reader_epoch)
+    , _clock(0)
+{
+    set_capacity(capacity_bytes);
+}
+
+PcmBlockCache::~PcmBlockCache()
+{
+    // Storages release their blocks before they go away
+    std::lock_guard lock(_mutex);
+    _entries.clear();
+    _retired.clear();
+}
+
+void PcmBlockCache::set_capacity(size_t bytes)
+{
+    std::lock_guard lock(_mutex);
+    _capacity_blocks = std::max<size_t>(1, bytes / BLOCK_BYTES);
+
+    while (_entries.size() > _capacity_blocks) {
+        evict_locked(least_recently_used_locked());
+    }
+
+    reclaim_locked();
+}
+
+size_t PcmBlockCache::capacity() const
+{
+    std::lock_guard lock(_mutex);
+    return _capacity_blocks * BLOCK_BYTES;
+}
+
+size_t PcmBlockCache::used_bytes() const
+{
+    std::lock_guard lock(_mutex);
+    return (_entries.size() + _retired.size()) * BLOCK_BYTES;
+}
+
+uint32_t PcmBlockCache::now() const
+{
+    return _clock.load(std::memory_order_relaxed);
+}
+
+void PcmBlockCache::tick()
+{
+    _clock.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PcmBlockCache::insert(StemStorage& owner, uint32_t block, const int16_t* samples,
+    uint32_t frames)
+{
+    auto memory = std::make_unique<int16_t[]>(BLOCK_FRAMES * 2);
+    memcpy(memory.get(), samples, frames * 2 * sizeof(int16_t));
+
+    std::lock_guard lock(_mutex);
+    reclaim_locked();
+
+    auto existing = std::find_if(_entries.begin(), _entries.end(), [&](const entry& e) {
+        return e.owner == &owner && e.block == block;
+    });
+
+    if (existing != _entries.end()) {
+        evict_locked(existing - _entries.begin());
+    } else if (_entries.size() >= _capacity_blocks) {
+        evict_locked(least_recently_used_locked());
+    }
+
+    owner.stamp_block(block, now());
+    owner.map_block(block, memory.get());
+    _entries.push_back({ .owner = &owner, .block = block, .samples = std::move(memory) });
+}
+
+bool PcmBlockCache::read(StemStorage& owner, uint32_t block, uint32_t offset,
+    uint32_t frames, int16_t* output)
+{
+    std::lock_guard lock(_mutex);
+    const int16_t* samples = owner.resident_block(block);
+
+    if (!samples) {
+        return false;
+    }
+
+    // Not a use by the mixer, so the block doesn't get any younger
+    memcpy(output, samples + 2 * offset, frames * 2 * sizeof(int16_t));
+    return true;
+}
+
+bool PcmBlockCache::resident(const StemStorage& owner, uint32_t block) const
+{
+    std::lock_guard lock(_mutex);
+    return owner.resident_block(block) != nullptr;
+}
+
+void PcmBlockCache::release(StemStorage& owner)
+{
+    std::lock_guard lock(_mutex);
+
+    for (size_t i = _entries.size(); i-- > 0; ) {
+        if (_entries[i].owner == &owner) {
+            evict_locked(i);
+        }
+    }
+
+    reclaim_locked();
+}
+
+size_t PcmBlockCache::least_recently_used_locked() const
+{
+    // A few hundred blocks at most, and only scanned when the cache is full
+    size_t oldest = 0;
+    uint32_t oldest_stamp = _entries[0].owner->block_stamp(_entries[0].block);
+
+    for (size_t i = 1; i < _entries.size(); ++i) {
+        uint32_t stamp = _entries[i].owner->block_stamp(_entries[i].block);
+        if (stamp < oldest_stamp) {
+            oldest = i;
+            oldest_stamp = stamp;
+        }
+    }
+
+    return oldest;
+}
+
+void PcmBlockCache::evict_locked(size_t index)
+{
+    entry& evicted = _entries[index];
+    evicted.owner->unmap_block(evicted.block);
+
+    _retired.push_back({
+        .samples = std::move(evicted.samples),
+        .reader_epoch = _reader_epoch.load(),
+    });
+
+    std::swap(evicted, _entries.back());
+    _entries.pop_back();
+}
+
+void PcmBlockCache::reclaim_locked()
+{
+    uint32_t reader_epoch = _reader_epoch.load();
+
+    // If no render was in progress or the counter has moved since then,
+    // the mixer can't be reading the block anymore
+    std::erase_if(_retired, [reader_epoch](const retired_block& retired) {
+        return (retired.reader_epoch & 1) == 0 || retired.reader_epoch != reader_epoch;
+    });
+}
@@ -171,11 +171,11 @@ public:
         return Utils::gain_to_decibels(_right_peak);
     }
 
-    void process(const audio_chunk& chunk)
+    void process(const audio_span& block)
     {
-        for (int i = 0; i < AUDIO_CHUNK_SAMPLES; ++i) {
-            process_sample(chunk.left_channel[i], _left_lpf, _left_peak);
-            process_sample(chunk.right_channel[i], _right_lpf, _right_peak);
+        for (int i = 0; i < block.frames; ++i) {
+            process_sample(block.left_channel[i], _left_lpf, _left_peak);
+            process_sample(block.right_channel[i], _right_lpf, _right_peak);
         }
     }
 
@@ -203,9 +203,9 @@ double PeakMeter::right_db() const
     return _pimpl->right_db();
 }
 
-void PeakMeter::process(const audio_chunk& chunk)
+void PeakMeter::process(const audio_span& block)
 {
-    _pimpl->process(chunk);
+    _pimpl->process(block);
 }
 
 void PeakMeter::reset()
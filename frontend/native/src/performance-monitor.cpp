@@ -0,0 +1,119 @@
+#include <performance-monitor.h>
+
+#include <audio-buffer.h>
+
+#include <algorithm>
+#include <cmath>
+
+
+const double PerformanceMonitor::MIXDOWN_BUCKET_MS = 0.05;
+const int PerformanceMonitor::MIXDOWN_BUCKETS = 64; // the last one catches everything above
+const int PerformanceMonitor::UNDERFLOW_EVENTS = 64;
+const double PerformanceMonitor::MAX_READ_INTERVAL_MS = 1000.0; // longer gaps mean a suspended context
+
+PerformanceMonitor::PerformanceMonitor(int buffer_capacity, int sample_rate)
+    : _mixdown_histogram(std::make_unique<Counter[]>(MIXDOWN_BUCKETS))
+    , _mixdown_total_ms(0.0)
+    , _mixdown_max_ms(0.0)
+    , _mixdown_count(0)
+    , _fill_buckets(buffer_capacity / AUDIO_CHUNK_SAMPLES + 1)
+    , _fill_histogram(std::make_unique<Counter[]>(_fill_buckets))
+    , _worst_jitter_ms(0.0)
+    , _quantum_ms(1000.0 * AUDIO_CHUNK_SAMPLES / sample_rate)
+    , _last_read_ms(-1.0)
+    , _underflow_events(std::make_unique<std::atomic<double>[]>(UNDERFLOW_EVENTS))
+    , _underflow_count(0)
+{
+    for (int i = 0; i < MIXDOWN_BUCKETS; ++i) _mixdown_histogram[i] = 0;
+    for (int i = 0; i < _fill_buckets; ++i) _fill_histogram[i] = 0;
+    for (int i = 0; i < UNDERFLOW_EVENTS; ++i) _underflow_events[i] = 0.0;
+}
+
+void PerformanceMonitor::record_mixdown(double duration_ms)
+{
+    int bucket = static_cast<int>(duration_ms / MIXDOWN_BUCKET_MS);
+    bucket = std::clamp(bucket, 0, MIXDOWN_BUCKETS - 1);
+    increment(_mixdown_histogram[bucket]);
+
+    _mixdown_total_ms.store(
+        _mixdown_total_ms.load(std::memory_order_relaxed) + duration_ms, std::memory_order_relaxed);
+    if (duration_ms > _mixdown_max_ms.load(std::memory_order_relaxed)) {
+        _mixdown_max_ms.store(duration_ms, std::memory_order_relaxed);
+    }
+
+    increment(_mixdown_count);
+}
+
+void PerformanceMonitor::record_read(int fill_level, double timestamp_ms)
+{
+    int bucket = std::clamp(fill_level / AUDIO_CHUNK_SAMPLES, 0, _fill_buckets - 1);
+    increment(_fill_histogram[bucket]);
+
+    if (_last_read_ms >= 0.0) {
+        double interval = timestamp_ms - _last_read_ms;
+        double jitter = std::abs(interval - _quantum_ms);
+
+        if (interval < MAX_READ_INTERVAL_MS 
+            && jitter > _worst_jitter_ms.load(std::memory_order_relaxed)) {
+            _worst_jitter_ms.store(jitter, std::memory_order_relaxed);
+        }
+    }
+
+    _last_read_ms = timestamp_ms;
+}
+
+void PerformanceMonitor::record_underflow(double timestamp_ms)
+{
+    uint32_t index = _underflow_count.load(std::memory_order_relaxed);
+    _underflow_events[index % UNDERFLOW_EVENTS].store(timestamp_ms, std::memory_order_relaxed);
+    _underflow_count.store(index + 1, std::memory_order_release);
+}
+
+performance_stats PerformanceMonitor::snapshot() const
+{
+    performance_stats stats;
+    stats.mixdown_bucket_ms = MIXDOWN_BUCKET_MS;
+    stats.mixdown_histogram.resize(MIXDOWN_BUCKETS);
+    for (int i = 0; i < MIXDOWN_BUCKETS; ++i) {
+        stats.mixdown_histogram[i] = _mixdown_histogram[i].load(std::memory_order_relaxed);
+    }
+
+    uint32_t mixdown_count = _mixdown_count.load(std::memory_order_relaxed);
+    stats.mixdown_mean_ms = mixdown_count 
+        ? _mixdown_total_ms.load(std::memory_order_relaxed) / mixdown_count : 0.0;
+    stats.mixdown_max_ms = _mixdown_max_ms.load(std::memory_order_relaxed);
+
+    stats.fill_bucket_samples = AUDIO_CHUNK_SAMPLES;
+    stats.fill_histogram.resize(_fill_buckets);
+    for (int i = 0; i < _fill_buckets; ++i) {
+        stats.fill_histogram[i] = _fill_histogram[i].load(std::memory_order_relaxed);
+    }
+
+    stats.worst_jitter_ms = _worst_jitter_ms.load(std::memory_order_relaxed);
+
+    // Return the most recent underflow events, oldest first
+    uint32_t underflows = _underflow_count.load(std::memory_order_acquire);
+    uint32_t first_event = underflows > static_cast<uint32_t>(UNDERFLOW_EVENTS) 
+        ? underflows - UNDERFLOW_EVENTS : 0;
+
+    stats.underflow_count = underflows;
+    for (uint32_t i = first_event; i < underflows; ++i) {
+        stats.underflow_timestamps_ms.push_back(
+            _underflow_events[i % UNDERFLOW_EVENTS].load(std::memory_order_relaxed));
+    }
+
+    // Filled in by the owners of the output and the background tasks
+    stats.output_latency = 0;
+    stats.task_queue_peak = 0;
+    stats.tasks_running = 0;
+    stats.tasks_completed = 0;
+    stats.tasks_cancelled = 0;
+    stats.tasks_coalesced = 0;
+    return stats;
+}
+
+void PerformanceMonitor::increment(Counter& counter)
+{
+    // There is only one writer, so a full read-modify-write is not needed
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
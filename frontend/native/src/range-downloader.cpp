@@ -0,0 +1,385 @@
+#include <range-downloader.h>
+
+#include <emscripten/fetch.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <semaphore>
+#include <thread>
+
+
+const int RangeDownloader::MAX_REQUESTS_IN_FLIGHT = 6; // as many as browsers open per host
+const int RangeDownloader::RETRY_BASE_DELAY_MS = 500;
+const int RangeDownloader::RETRY_MAX_DELAY_MS = 8000;
+const int RangeDownloader::CANCEL_POLL_MS = 100;
+const int RangeDownloader::RANGES_AHEAD_PER_CONNECTION = 2;
+
+// Shared by all downloaders, see `MAX_REQUESTS_IN_FLIGHT`
+static std::counting_semaphore<> g_request_slots(RangeDownloader::MAX_REQUESTS_IN_FLIGHT);
+
+/* 
+ * Returns the value of a response header (given in lower case), or an empty
+ * string if it's missing or hidden from cross-origin requests
+ */
+static std::string response_header(emscripten_fetch_t* fetch, const char* name)
+{
+    size_t length = emscripten_fetch_get_response_headers_length(fetch);
+    std::string headers(length + 1, '\0');
+    emscripten_fetch_get_response_headers(fetch, headers.data(), headers.size());
+
+    std::transform(headers.begin(), headers.end(), headers.begin(), [](char c) {
+        return std::tolower(static_cast<unsigned char>(c));
+    });
+
+    size_t header = headers.find(std::string(name) + ":");
+    if (header == std::string::npos) {
+        return std::string();
+    }
+
+    size_t value = header + strlen(name) + 1;
+    size_t line_end = headers.find_first_of("\r\n", value);
+    return headers.substr(value, line_end == std::string::npos ? line_end : line_end - value);
+}
+
+/* Returns the total size from a "Content-Range: bytes a-b/total" header, or 0 */
+static uint64_t parse_total_size(emscripten_fetch_t* fetch)
+{
+    std::string range = response_header(fetch, "content-range");
+    size_t slash = range.find('/');
+    if (slash == std::string::npos) {
+        return 0;
+    }
+
+    // An unknown length ("*") parses as 0 as well
+    return strtoull(range.c_str() + slash + 1, nullptr, 10);
+}
+
+RangeDownloader::RangeDownloader(std::string url, uint32_t chunk_bytes, int connections,
+    int retry_count, CancelCheck cancelled, TaskPool& pool)
+    : _url(std::move(url))
+    , _chunk_bytes(chunk_bytes)
+    , _connections(std::max(1, connections))
+    , _retry_count(retry_count)
+    , _cancelled(std::move(cancelled))
+    , _pool(pool)
+    , _offset(0)
+    , _total(0)
+    , _finished(false)
+    , _failed(false)
+    , _ranges_offset(0)
+    , _ranges(0)
+    , _next_claimed(0)
+    , _next_returned(0)
+    , _ranges_status(FetchStatus::OK)
+    , _stop(false)
+{
+}
+
+RangeDownloader::~RangeDownloader()
+{
+    {
+        std::lock_guard lock(_mutex);
+        _stop = true;
+    }
+
+    _range_done.notify_all();
+    for (const TaskPool::HelperJob& helper : _helpers) {
+        _pool.wait_helper(helper);
+    }
+}
+
+bool RangeDownloader::next(std::vector<uint8_t>& chunk)
+{
+    if (_finished || _failed) {
+        return false;
+    }
+
+    return _ranges != 0 ? next_parallel(chunk) : next_sequential(chunk);
+}
+
+bool RangeDownloader::failed() const
+{
+    return _failed;
+}
+
+uint64_t RangeDownloader::downloaded_bytes() const
+{
+    return _offset;
+}
+
+uint64_t RangeDownloader::total_bytes() const
+{
+    return _total;
+}
+
+auto RangeDownloader::fetch_range(uint64_t first, uint64_t last, fetched_range& range) -> FetchStatus
+{
+    char range_header[64];
+    snprintf(range_header, sizeof(range_header), "bytes=%llu-%llu",
+        static_cast<unsigned long long>(first),
+        static_cast<unsigned long long>(last));
+    const char* headers[] = { "Range", range_header, nullptr };
+
+    emscripten_fetch_attr_t attr;
+    emscripten_fetch_attr_init(&attr);
+    strcpy(attr.requestMethod, "GET");
+    attr.attributes = EMSCRIPTEN_FETCH_LOAD_TO_MEMORY | EMSCRIPTEN_FETCH_SYNCHRONOUS;
+    attr.requestHeaders = headers;
+
+    for (int approach = 0; approach < _retry_count; ++approach) {
+        if (_cancelled && _cancelled()) {
+            return FetchStatus::CANCELLED;
+        }
+
+        if (!acquire_request_slot()) {
+            return FetchStatus::CANCELLED;
+        }
+
+        emscripten_fetch_t* fetch = emscripten_fetch(&attr, _url.c_str());
+        g_request_slots.release();
+        unsigned short status = fetch->status;
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(fetch->data);
+        uint64_t bytes = fetch->numBytes;
+
+        if (status >= 200 && status <= 299) {
+            // 206 is the requested range, anything else the whole file
+            range.data.assign(data, data + bytes);
+            range.partial = status == 206;
+            range.total = range.partial ? parse_total_size(fetch) : bytes;
+            emscripten_fetch_close(fetch);
+            return FetchStatus::OK;
+        }
+
+        emscripten_fetch_close(fetch);
+
+        if (status == 416) {
+            return FetchStatus::PAST_END;
+        }
+
+        if (approach + 1 < _retry_count) {
+            fprintf(stderr, "Download of \"%s\" failed at byte %llu! Retrying %d more time(s)...\n",
+                _url.c_str(), static_cast<unsigned long long>(first),
+                _retry_count - approach - 1);
+
+            if (!wait_before_retry(approach)) {
+                return FetchStatus::CANCELLED;
+            }
+        }
+    }
+
+    return FetchStatus::FAILED;
+}
+
+uint64_t RangeDownloader::probe_total_size()
+{
+    emscripten_fetch_attr_t attr;
+    emscripten_fetch_attr_init(&attr);
+    strcpy(attr.requestMethod, "HEAD");
+    attr.attributes = EMSCRIPTEN_FETCH_SYNCHRONOUS;
+
+    if (!acquire_request_slot()) {
+        return 0;
+    }
+
+    emscripten_fetch_t* fetch = emscripten_fetch(&attr, _url.c_str());
+    g_request_slots.release();
+
+    // Unlike `Content-Range`, `Content-Length` is always exposed
+    uint64_t total = 0;
+    if (fetch->status >= 200 && fetch->status <= 299) {
+        total = strtoull(response_header(fetch, "content-length").c_str(), nullptr, 10);
+    }
+
+    emscripten_fetch_close(fetch);
+    return total;
+}
+
+bool RangeDownloader::acquire_request_slot()
+{
+    // Poll, a removed stem shouldn't wait for the others' requests
+    while (!g_request_slots.try_acquire_for(std::chrono::milliseconds(CANCEL_POLL_MS))) {
+        if (_cancelled && _cancelled()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool RangeDownloader::wait_before_retry(int approach)
+{
+    int delay_ms = std::min(RETRY_BASE_DELAY_MS << std::min(approach, 16), RETRY_MAX_DELAY_MS);
+
+    // Sleep in slices, a removed stem shouldn't keep its thread for seconds
+    for (int waited_ms = 0; waited_ms < delay_ms; waited_ms += CANCEL_POLL_MS) {
+        if (_cancelled && _cancelled()) {
+            return false;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(
+            std::min(CANCEL_POLL_MS, delay_ms - waited_ms)));
+    }
+
+    return true;
+}
+
+bool RangeDownloader::next_sequential(std::vector<uint8_t>& chunk)
+{
+    fetched_range range;
+    FetchStatus status = fetch_range(_offset, _offset + _chunk_bytes - 1, range);
+
+    switch (status) {
+        case FetchStatus::OK:
+            break;
+        case FetchStatus::PAST_END:
+            // Fine if the file ended exactly at a chunk boundary
+            _finished = _offset > 0;
+            _failed = !_finished;
+            return false;
+        case FetchStatus::FAILED:
+            _failed = true;
+            return false;
+        case FetchStatus::CANCELLED:
+            _finished = true;
+            return false;
+    }
+
+    if (!range.partial) {
+        // The range was ignored and this is the whole file
+        uint64_t skipped = std::min<uint64_t>(_offset, range.data.size());
+        chunk.assign(range.data.begin() + skipped, range.data.end());
+        _offset = _total = range.data.size();
+        _finished = true;
+        return !chunk.empty();
+    }
+
+    bool first_range = _offset == 0;
+    if (_total == 0) {
+        _total = range.total;
+    }
+
+    if (first_range && _total == 0 && range.data.size() == _chunk_bytes) {
+        _total = probe_total_size();
+    }
+
+    chunk = std::move(range.data);
+    _offset += chunk.size();
+    _finished = chunk.size() < _chunk_bytes || (_total != 0 && _offset >= _total);
+
+    // Now that the size is known, the rest can be requested all at once.
+    // Without it, the end is only found by fetching past it.
+    if (first_range && !_finished && _total != 0 && _connections > 1) {
+        start_parallel();
+    }
+
+    return true;
+}
+
+void RangeDownloader::start_parallel()
+{
+    _ranges_offset = _offset;
+    _ranges = (_total - _offset + _chunk_bytes - 1) / _chunk_bytes;
+
+    // The thread calling `next()` is a connection too. With no helper
+    // free, it fetches all the ranges itself.
+    uint64_t helpers = std::min<uint64_t>(_connections - 1, _ranges - 1);
+    for (uint64_t i = 0; i < helpers; ++i) {
+        TaskPool::HelperJob helper = _pool.try_run_helper([this]() { helper_main(); });
+        if (!helper) {
+            break;
+        }
+
+        _helpers.push_back(std::move(helper));
+    }
+}
+
+bool RangeDownloader::next_parallel(std::vector<uint8_t>& chunk)
+{
+    std::unique_lock lock(_mutex);
+
+    while (true) {
+        auto fetched = _fetched.find(_next_returned);
+        if (fetched != _fetched.end()) {
+            chunk = std::move(fetched->second);
+            _fetched.erase(fetched);
+            ++_next_returned;
+            _offset += chunk.size();
+            _finished = _next_returned == _ranges;
+
+            // Let the helpers claim more ranges
+            lock.unlock();
+            _range_done.notify_all();
+            return true;
+        }
+
+        if (_ranges_status == FetchStatus::CANCELLED) {
+            _finished = true;
+            return false;
+        }
+
+        if (_ranges_status != FetchStatus::OK) {
+            _failed = true;
+            return false;
+        }
+
+        // Fetch a range instead of just waiting for the next one
+        if (!fetch_claimed_locked(lock)) {
+            _range_done.wait(lock);
+        }
+    }
+}
+
+bool RangeDownloader::fetch_claimed_locked(std::unique_lock<std::mutex>& lock)
+{
+    // Don't get too far ahead of the chunks returned so far, these are the
+    // ones that can't be used yet
+    uint64_t window_end = _next_returned + _connections * RANGES_AHEAD_PER_CONNECTION;
+
+    if (_stop || _ranges_status != FetchStatus::OK
+        || _next_claimed >= std::min(_ranges, window_end)) {
+        return false;
+    }
+
+    uint64_t index = _next_claimed++;
+    uint64_t first = _ranges_offset + index * _chunk_bytes;
+    uint64_t last = std::min(first + _chunk_bytes, _total) - 1;
+
+    lock.unlock();
+
+    fetched_range range;
+    FetchStatus status = fetch_range(first, last, range);
+
+    if (status == FetchStatus::OK && !range.partial) {
+        // The server stopped honoring ranges, cut this one out of the file
+        size_t begin = std::min<uint64_t>(first, range.data.size());
+        size_t end = std::min<uint64_t>(last + 1, range.data.size());
+        range.data = std::vector<uint8_t>(range.data.begin() + begin, range.data.begin() + end);
+    }
+
+    lock.lock();
+
+    if (status == FetchStatus::OK) {
+        _fetched[index] = std::move(range.data);
+    } else if (_ranges_status == FetchStatus::OK) {
+        // The size was known, so a range past the end means the file changed
+        _ranges_status = status == FetchStatus::PAST_END ? FetchStatus::FAILED : status;
+    }
+
+    _range_done.notify_all();
+    return true;
+}
+
+void RangeDownloader::helper_main()
+{
+    std::unique_lock lock(_mutex);
+
+    while (!_stop && _ranges_status == FetchStatus::OK && _next_claimed < _ranges) {
+        if (!fetch_claimed_locked(lock)) {
+            _range_done.wait(lock);
+        }
+    }
+}
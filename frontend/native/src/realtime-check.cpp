@@ -0,0 +1,114 @@
+#include <realtime-check.h>
+
+#ifdef GS_REALTIME_CHECKS
+
+#include <emscripten.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <pthread.h>
+
+
+static const uint32_t MAX_REPORTED_VIOLATIONS = 32;
+
+static thread_local int t_realtime_depth = 0;
+static thread_local bool t_reporting = false;
+static std::atomic<uint32_t> g_violation_count = 0;
+
+void RealtimeCheck::enter()
+{
+    ++t_realtime_depth;
+}
+
+void RealtimeCheck::leave()
+{
+    --t_realtime_depth;
+}
+
+bool RealtimeCheck::active()
+{
+    return t_realtime_depth > 0 && !t_reporting;
+}
+
+void RealtimeCheck::report(const char* operation)
+{
+    if (!active()) return;
+
+    // Logging allocates and locks by itself - don't report that
+    t_reporting = true;
+
+    uint32_t count = ++g_violation_count;
+    if (count <= MAX_REPORTED_VIOLATIONS) {
+        emscripten_log(EM_LOG_CONSOLE | EM_LOG_WARN | EM_LOG_C_STACK, 
+            "[REALTIME] %s on a realtime thread (violation #%u)", operation, count);
+    }
+
+    t_reporting = false;
+}
+
+uint32_t RealtimeCheck::violation_count()
+{
+    return g_violation_count;
+}
+
+// Replaceable global allocation functions
+
+void* operator new(std::size_t size)
+{
+    RealtimeCheck::report("Heap allocation");
+
+    void* ptr = std::malloc(size ? size : 1);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](std::size_t size)
+{
+    return ::operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    RealtimeCheck::report("Heap allocation");
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept
+{
+    return ::operator new(size, tag);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (ptr) RealtimeCheck::report("Heap deallocation");
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    ::operator delete(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    ::operator delete(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+    ::operator delete(ptr);
+}
+
+// musl exports pthread_mutex_lock as a weak alias of __pthread_mutex_lock,
+// so a strong definition here intercepts every std::mutex lock as well
+
+extern "C" int __pthread_mutex_lock(pthread_mutex_t* mutex);
+
+extern "C" int pthread_mutex_lock(pthread_mutex_t* mutex)
+{
+    RealtimeCheck::report("Mutex lock");
+    return __pthread_mutex_lock(mutex);
+}
+
+#endif // GS_REALTIME_CHECKS
@@ -0,0 +1,78 @@
+#include <render-pool.h>
+
+#include <algorithm>
+#include <cassert>
+
+
+RenderPool::RenderPool(int workers, Job job)
+    : _job(std::move(job))
+    , _generation(0)
+    , _partitions(0)
+    , _pending(0)
+    , _quit(false)
+{
+    for (int i = 0; i < workers; ++i) {
+        _threads.emplace_back(&RenderPool::thread_main, this, i + 1);
+    }
+}
+
+RenderPool::~RenderPool()
+{
+    _quit = true;
+    _generation.fetch_add(1, std::memory_order_release);
+    _generation.notify_all();
+
+    for (std::thread& thread : _threads) {
+        thread.join();
+    }
+}
+
+int RenderPool::max_partitions() const
+{
+    return _threads.size() + 1;
+}
+
+void RenderPool::run(int partitions)
+{
+    assert(partitions >= 1 && partitions <= max_partitions());
+
+    if (partitions > 1) {
+        // Every worker is woken up, those without a partition just report back
+        _partitions.store(partitions, std::memory_order_relaxed);
+        _pending.store(_threads.size(), std::memory_order_relaxed);
+        _generation.fetch_add(1, std::memory_order_release);
+        _generation.notify_all();
+    }
+
+    _job(0);
+
+    if (partitions > 1) {
+        int pending;
+        while ((pending = _pending.load(std::memory_order_acquire)) != 0) {
+            _pending.wait(pending, std::memory_order_acquire);
+        }
+    }
+}
+
+void RenderPool::thread_main(int partition)
+{
+    // Start from the initial generation, the first run may come before this thread starts
+    uint32_t seen_generation = 0;
+
+    while (true) {
+        _generation.wait(seen_generation, std::memory_order_acquire);
+        seen_generation = _generation.load(std::memory_order_acquire);
+
+        if (_quit) {
+            return;
+        }
+
+        if (partition < _partitions.load(std::memory_order_relaxed)) {
+            _job(partition);
+        }
+
+        if (_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            _pending.notify_one();
+        }
+    }
+}
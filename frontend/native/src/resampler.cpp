@@ -0,0 +1,176 @@
+#include <resampler.h>
+
+#include <audio-buffer.h>
+
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <numeric>
+
+
+const double Resampler::KAISER_BETA = 8.0; // ~80 dB of stopband attenuation
+const double Resampler::CUTOFF_RATIO = 0.92; // of the lower Nyquist frequency
+
+static double bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; ++k) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+Resampler::Resampler(int input_rate, int output_rate)
+    : _input_rate(input_rate)
+    , _output_rate(output_rate)
+    , _input_left(nullptr)
+    , _input_right(nullptr)
+{
+    assert(input_rate > 0 && output_rate > 0);
+
+    find_ratio();
+    if (!bypass()) {
+        design_filter();
+    }
+
+    reset();
+}
+
+bool Resampler::bypass() const
+{
+    return _input_rate == _output_rate;
+}
+
+int Resampler::input_rate() const
+{
+    return _input_rate;
+}
+
+int Resampler::output_rate() const
+{
+    return _output_rate;
+}
+
+bool Resampler::needs_input() const
+{
+    return _pending_inputs > 0 && _input_position == _input_frames;
+}
+
+int Resampler::input_offset() const
+{
+    return _input_position;
+}
+
+void Resampler::feed(const audio_span& input)
+{
+    assert(_input_position == _input_frames);
+
+    _input_left = input.left_channel;
+    _input_right = input.right_channel;
+    _input_position = 0;
+    _input_frames = input.frames;
+}
+
+int Resampler::process(audio_chunk& output, int first_frame)
+{
+    int frame = first_frame;
+
+    while (frame < AUDIO_CHUNK_SAMPLES) {
+        while (_pending_inputs > 0) {
+            if (_input_position == _input_frames) {
+                return frame - first_frame;
+            }
+
+            _left_filter.push(_input_left[_input_position]);
+            _right_filter.push(_input_right[_input_position]);
+            ++_input_position;
+            --_pending_inputs;
+        }
+
+        const float* phase_coeffs = &_coeffs[_phase * TAPS];
+        output.left_channel[frame] = _left_filter(phase_coeffs);
+        output.right_channel[frame] = _right_filter(phase_coeffs);
+        ++frame;
+
+        _phase += _decimation;
+        _pending_inputs = _phase / _phases;
+        _phase %= _phases;
+    }
+
+    return frame - first_frame;
+}
+
+void Resampler::reset()
+{
+    _left_filter.reset();
+    _right_filter.reset();
+    _input_position = 0;
+    _input_frames = 0;
+    _phase = 0;
+    _pending_inputs = 1;
+}
+
+void Resampler::find_ratio()
+{
+    int divisor = std::gcd(_input_rate, _output_rate);
+    _phases = _output_rate / divisor;
+    _decimation = _input_rate / divisor;
+
+    if (_phases <= MAX_PHASES) {
+        return;
+    }
+
+    // Exotic rates - pick the closest ratio that we can afford. This makes
+    // the output sample rate off by a tiny fraction of a percent.
+    double ratio = static_cast<double>(_output_rate) / _input_rate;
+    double best_error = INFINITY;
+
+    for (int phases = 1; phases <= MAX_PHASES; ++phases) {
+        int decimation = std::max(1, static_cast<int>(std::lround(phases / ratio)));
+        double error = std::abs(static_cast<double>(phases) / decimation - ratio);
+
+        if (error < best_error) {
+            best_error = error;
+            _phases = phases;
+            _decimation = decimation;
+        }
+    }
+}
+
+void Resampler::design_filter()
+{
+    // Windowed sinc low-pass at the upsampled rate (L * input rate)
+    int length = _phases * TAPS;
+    double nyquist = 0.5 * std::min(_input_rate, _output_rate);
+    double cutoff = CUTOFF_RATIO * nyquist / (static_cast<double>(_phases) * _input_rate);
+    double center = (length - 1) / 2.0;
+    double window_norm = bessel_i0(KAISER_BETA);
+
+    std::vector<double> prototype(length);
+    double sum = 0.0;
+
+    for (int n = 0; n < length; ++n) {
+        double x = n - center;
+        double sinc = x == 0.0 
+            ? 2.0 * cutoff 
+            : std::sin(2.0 * M_PI * cutoff * x) / (M_PI * x);
+
+        double window_pos = 2.0 * n / (length - 1) - 1.0;
+        double window = bessel_i0(KAISER_BETA * std::sqrt(1.0 - window_pos * window_pos)) / window_norm;
+
+        prototype[n] = sinc * window;
+        sum += prototype[n];
+    }
+
+    // Split into phases. Every phase has a DC gain of ~1 after scaling by L,
+    // and coefficients are stored from the oldest input sample to the newest.
+    _coeffs.resize(length);
+    for (int phase = 0; phase < _phases; ++phase) {
+        for (int k = 0; k < TAPS; ++k) {
+            double value = prototype[phase + k * _phases] * _phases / sum;
+            _coeffs[phase * TAPS + (TAPS - 1 - k)] = static_cast<float>(value);
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#include <silence-index.h>
+
+
+const uint32_t SilenceIndex::BLOCK_FRAMES = 256;
+const int16_t SilenceIndex::DIGITAL_SILENCE_THRESHOLD = 1; // |sample| < 1, i.e. zero
+
+void SilenceIndex::reset(uint32_t blocks)
+{
+    uint32_t words = (blocks + 63) / 64;
+    _silent_bits = std::make_unique<std::atomic<uint64_t>[]>(words);
+    for (uint32_t word = 0; word < words; ++word) {
+        _silent_bits[word].store(0, std::memory_order_relaxed);
+    }
+
+    _total_blocks = blocks;
+    _silent_blocks = 0;
+}
+
+bool SilenceIndex::store_block(uint32_t block, const int16_t* samples, uint32_t frames, 
+    int16_t threshold)
+{
+    if (block >= _total_blocks) {
+        return false;
+    }
+
+    for (uint32_t frame = 0; frame < frames; ++frame) {
+        if (!is_silent(samples[2 * frame], samples[2 * frame + 1], threshold)) {
+            return false;
+        }
+    }
+
+    // Readers of neighbouring blocks may load the same word meanwhile
+    _silent_bits[block / 64].fetch_or(uint64_t(1) << (block % 64), std::memory_order_relaxed);
+    ++_silent_blocks;
+    return true;
+}
+
+bool SilenceIndex::silent(uint32_t first_frame, uint32_t frames) const
+{
+    if (frames == 0) {
+        return true;
+    }
+
+    uint32_t first_block = first_frame / BLOCK_FRAMES;
+    uint32_t last_block = (first_frame + frames - 1) / BLOCK_FRAMES;
+    if (last_block >= _total_blocks) {
+        return false;
+    }
+
+    for (uint32_t block = first_block; block <= last_block; ++block) {
+        uint64_t word = _silent_bits[block / 64].load(std::memory_order_relaxed);
+        if ((word & (uint64_t(1) << (block % 64))) == 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint32_t SilenceIndex::silent_blocks() const
+{
+    return _silent_blocks;
+}
+
+uint32_t SilenceIndex::total_blocks() const
+{
+    return _total_blocks;
+}
@@ -0,0 +1,262 @@
+#include <stem-cache.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+
+
+const char* StemCache::INDEX_NAME = "index";
+const int StemCache::INDEX_SAVE_INTERVAL_MS = 30000;
+
+StemCache::StemCache(std::unique_ptr<CacheBackend> backend, uint64_t capacity_bytes)
+    : _backend(std::move(backend))
+    , _capacity(capacity_bytes)
+    , _used(0)
+    , _index_dirty(false)
+{
+    std::lock_guard lock(_mutex);
+    open_locked();
+}
+
+StemCache::~StemCache()
+{
+    std::lock_guard lock(_mutex);
+
+    if (_index_dirty) {
+        save_index_locked();
+        _backend->flush();
+    }
+}
+
+bool StemCache::load(const std::string& key, std::vector<uint8_t>& data)
+{
+    std::lock_guard lock(_mutex);
+
+    auto cached = std::find_if(_entries.begin(), _entries.end(), [&key](const entry& e) {
+        return e.key == key;
+    });
+
+    if (cached == _entries.end()) {
+        return false;
+    }
+
+    if (!_backend->read(cached->name, data) || data.size() != cached->bytes) {
+        // Damaged somehow, download it again
+        erase_locked(cached - _entries.begin());
+        save_index_locked();
+        _backend->flush();
+
+        data.clear();
+        return false;
+    }
+
+    // The most recently used one now. Opening a song hits many files at
+    // once, the index isn't rewritten for every one of them.
+    cached->used_in_session = true;
+    std::rotate(cached, cached + 1, _entries.end());
+    _index_dirty = true;
+    save_index_if_due_locked();
+    return true;
+}
+
+bool StemCache::store(const std::string& key, const std::vector<uint8_t>& data,
+    bool spare_session)
+{
+    std::lock_guard lock(_mutex);
+
+    // Not worth evicting everything else
+    if (data.size() > _capacity) {
+        return false;
+    }
+
+    // Also replaces another key with the same hash, `load()` compares keys
+    std::string name = blob_name(key);
+    auto replaced = std::find_if(_entries.begin(), _entries.end(), [&name](const entry& e) {
+        return e.name == name;
+    });
+
+    if (replaced != _entries.end()) {
+        erase_locked(replaced - _entries.begin());
+    }
+
+    bool stored = evict_locked(data.size(), spare_session)
+        && _backend->write(name, data.data(), data.size());
+
+    if (stored) {
+        _entries.push_back({
+            .name = name,
+            .key = key,
+            .bytes = data.size(),
+            .used_in_session = true,
+        });
+        _used += data.size();
+    }
+
+    save_index_locked();
+    _backend->flush();
+    return stored;
+}
+
+void StemCache::remove(const std::string& key)
+{
+    std::lock_guard lock(_mutex);
+
+    auto cached = std::find_if(_entries.begin(), _entries.end(), [&key](const entry& e) {
+        return e.key == key;
+    });
+
+    if (cached != _entries.end()) {
+        erase_locked(cached - _entries.begin());
+        save_index_locked();
+        _backend->flush();
+    }
+}
+
+void StemCache::set_capacity(uint64_t bytes)
+{
+    _capacity = bytes;
+}
+
+uint64_t StemCache::capacity() const
+{
+    return _capacity;
+}
+
+uint64_t StemCache::used_bytes() const
+{
+    return _used;
+}
+
+std::string StemCache::blob_name(const std::string& key)
+{
+    // 64-bit FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : key) {
+        hash = (hash ^ c) * 0x100000001b3ULL;
+    }
+
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+    return name;
+}
+
+void StemCache::open_locked()
+{
+    std::vector<CacheBackend::blob> blobs = _backend->list();
+    std::vector<uint8_t> index;
+    bool changed = false;
+
+    if (_backend->read(INDEX_NAME, index)) {
+        // One "<name> <bytes> <key>" line per file, the least recently used first
+        std::istringstream lines(std::string(index.begin(), index.end()));
+        std::string line;
+
+        while (std::getline(lines, line)) {
+            std::istringstream fields(line);
+            entry cached;
+
+            if (!(fields >> cached.name >> cached.bytes) || fields.get() != ' ') {
+                changed = true;
+                continue;
+            }
+
+            std::getline(fields, cached.key);
+
+            bool stored = std::any_of(blobs.begin(), blobs.end(), [&cached](const auto& blob) {
+                return blob.name == cached.name && blob.bytes == cached.bytes;
+            });
+
+            bool duplicate = std::any_of(_entries.begin(), _entries.end(), [&cached](const entry& e) {
+                return e.name == cached.name;
+            });
+
+            if (stored && !duplicate && !cached.key.empty()) {
+                _used += cached.bytes;
+                _entries.push_back(std::move(cached));
+            } else {
+                changed = true;
+            }
+        }
+    }
+
+    // Files that aren't indexed were never stored completely
+    for (const CacheBackend::blob& blob : blobs) {
+        bool indexed = std::any_of(_entries.begin(), _entries.end(), [&blob](const entry& e) {
+            return e.name == blob.name;
+        });
+
+        if (!indexed && blob.name != INDEX_NAME) {
+            _backend->remove(blob.name);
+            changed = true;
+        }
+    }
+
+    size_t indexed_entries = _entries.size();
+    evict_locked(0);
+    changed |= _entries.size() != indexed_entries;
+
+    // Nothing to write back if the index was fine
+    if (changed) {
+        save_index_locked();
+        _backend->flush();
+    }
+
+    _index_saved_at = std::chrono::steady_clock::now();
+
+    printf("Stem cache: %zu file(s), %llu kB.\n",
+        _entries.size(), static_cast<unsigned long long>(_used.load() / 1024));
+}
+
+bool StemCache::evict_locked(uint64_t reserved_bytes, bool spare_session)
+{
+    // Nothing is evicted unless it makes enough room
+    uint64_t evictable = 0;
+    for (const entry& e : _entries) {
+        if (!spare_session || !e.used_in_session) {
+            evictable += e.bytes;
+        }
+    }
+
+    if (_used - evictable + reserved_bytes > _capacity) {
+        return false;
+    }
+
+    for (size_t index = 0; index < _entries.size() && _used + reserved_bytes > _capacity; ) {
+        if (spare_session && _entries[index].used_in_session) {
+            ++index;
+        } else {
+            erase_locked(index);
+        }
+    }
+
+    return true;
+}
+
+void StemCache::erase_locked(size_t index)
+{
+    _backend->remove(_entries[index].name);
+    _used -= _entries[index].bytes;
+    _entries.erase(_entries.begin() + index);
+}
+
+void StemCache::save_index_locked()
+{
+    std::string index;
+    for (const entry& e : _entries) {
+        index += e.name + " " + std::to_string(e.bytes) + " " + e.key + "\n";
+    }
+
+    _backend->write(INDEX_NAME, reinterpret_cast<const uint8_t*>(index.data()), index.size());
+    _index_dirty = false;
+    _index_saved_at = std::chrono::steady_clock::now();
+}
+
+void StemCache::save_index_if_due_locked()
+{
+    auto since_saved = std::chrono::steady_clock::now() - _index_saved_at;
+
+    if (_index_dirty && since_saved >= std::chrono::milliseconds(INDEX_SAVE_INTERVAL_MS)) {
+        save_index_locked();
+        _backend->flush();
+    }
+}
@@ -1,31 +1,102 @@
 #include <stem-manager.h>
 
 #include <audio-buffer.h>
-#include <stb_vorbis.h>
+#include <flac-stream-decoder.h>
+#include <mix-kernels.h>
+#include <range-downloader.h>
 #include <utils.h>
+#include <vorbis-stream-decoder.h>
 #include <waveform-renderer.h>
 
 #include <base64.h>
-#include <emscripten/fetch.h>
+#include <emscripten/heap.h>
 
+#include <algorithm>
 #include <cassert>
-#include <chrono>
 #include <cstdio>
+#include <malloc.h>
 #include <thread>
 #include <unordered_set>
 
 
 const float StemManager::SHORT_TO_FLOAT = 1 / 32768.f;
 const int StemManager::STEM_DOWNLOAD_RETRY_COUNT = 4;
+const uint32_t StemManager::STREAM_CHUNK_BYTES = 256 * 1024;
+const int StemManager::DOWNLOAD_CONNECTIONS = 3; // per stem
+const uint32_t StemManager::PARALLEL_DECODE_MIN_FRAMES = 1 << 20; // ~22 s at 48 kHz
+const int StemManager::MAX_DECODE_RANGES = 4;
+const int StemManager::MAX_RENDER_WORKERS = 3; // plus the mixer thread itself
+const int StemManager::RESERVED_CORES = 2; // for the main thread and the audio worklet
+const int StemManager::MIN_STEMS_PER_PARTITION = 4;
+const int StemManager::BACKGROUND_WORKERS = 6; // as many connections as browsers open per host
+const int StemManager::BACKGROUND_HELPERS = 10; // downloads and parallel ranges of running tasks
+const int64_t StemManager::PASSED_STEM_RANK = int64_t(1) << 32; // further than any stem start
+const int64_t StemManager::MUTED_STEM_RANK = int64_t(1) << 34;
+const size_t StemManager::DEFAULT_PCM_CACHE_BYTES = 64 * 1024 * 1024;
+const int StemManager::RETAINED_STEMS_HEAP_DIVISOR = 8; // 256 MB of a 2 GB heap, a song or two
+const int StemManager::FREE_HEAP_DIVISOR = 8; // for downloads, decoding and everything else
+const uint32_t StemManager::DECODE_AHEAD_BLOCKS = 4; // ~2.7 s at 48 kHz
 using std::nullopt;
 
+/* Decoders of the stem formats the backend produces */
+struct StemManager::stem_codec {
+    const char* name;
+    std::unique_ptr<StreamDecoder> (*create_decoder)(StemStorage::Writer& writer);
+    StreamDecoder::RangeDecoder decode_range;
+};
+
 StemManager::StemManager()
     : _length(0)
+    , _retained_stems_capacity(emscripten_get_heap_max() / RETAINED_STEMS_HEAP_DIVISOR)
+    , _decode_threads(0)
+    , _render_list(new RenderList())
+    , _render_epoch(0)
+    , _rendered_list(nullptr)
+    , _render_first_sample(0)
+    , _render_partitions(1)
+    , _render_frames(0)
+    , _render_stamp(0)
+    , _playhead_block(0)
+    , _lazy_decoding(false)
+    , _pcm_cache(std::make_shared<PcmBlockCache>(DEFAULT_PCM_CACHE_BYTES, _render_epoch))
+    , _playhead(0)
+    , _pcm_cache_missed(false)
+    , _decode_ahead_signal(0)
+    , _decode_ahead_quit(false)
 {
+    int cores = std::thread::hardware_concurrency();
+    int workers = std::clamp(cores - RESERVED_CORES, 0, MAX_RENDER_WORKERS);
+    _decode_thread_limit = std::max(1, cores - RESERVED_CORES);
+
+    _partial_buses = std::make_unique<audio_block[]>(workers + 1);
+    _render_pool = std::make_unique<RenderPool>(
+        workers, std::bind(&StemManager::render_partition, this, std::placeholders::_1));
+    _decode_ahead_thread = std::thread(&StemManager::decode_ahead_main, this);
+    _task_pool = std::make_unique<TaskPool>(BACKGROUND_WORKERS, BACKGROUND_HELPERS);
+}
+
+StemManager::~StemManager()
+{
+    // Stop the background work before anything it uses goes away
+    for (const auto& [ stem_id, stem_ptr ] : _stems) {
+        stem_ptr->deleted = true;
+    }
+    for (const StemEntryPtr& stem_ptr : _retained_stems) {
+        stem_ptr->deleted = true;
+    }
+    _task_pool.reset();
+
+    _decode_ahead_quit = true;
+    _decode_ahead_signal.fetch_add(1);
+    _decode_ahead_signal.notify_one();
+    _decode_ahead_thread.join();
+
+    delete _render_list.load();
 }
 
 void StemManager::set_track_length(uint32_t samples)
 {
+    reclaim_render_lists();
     _length = samples;
 
     for (const auto& [ stem_id, stem_ptr ] : _stems) {
@@ -68,6 +139,8 @@ void StemManager::toggle_mute(uint32_t stem_id)
     } else {
         _muted_stems.insert(stem_id);
     }
+
+    rebuild_render_list_locked();
 }
 
 void StemManager::toggle_solo(uint32_t stem_id)
@@ -82,6 +155,8 @@ void StemManager::toggle_solo(uint32_t stem_id)
     } else {
         _soloed_stem = stem_id;
     }
+
+    rebuild_render_list_locked();
 }
 
 void StemManager::unmute_all()
@@ -89,6 +164,8 @@ void StemManager::unmute_all()
     std::lock_guard lock(_mutex);
     _muted_stems.clear();
     _soloed_stem = nullopt;
+
+    rebuild_render_list_locked();
 }
 
 bool StemManager::stem_muted(uint32_t stem_id) const
@@ -133,49 +210,142 @@ void StemManager::set_bg_task_complete_callback(std::function<void()> callback)
     _complete_cb = callback;
 }
 
-void StemManager::render(uint32_t first_sample, audio_chunk& chunk)
+void StemManager::render(uint32_t first_sample, const audio_span& block, bool parallel)
 {
-    std::lock_guard main_lock(_mutex); // <-- this will be called from a worker thread
-    for (const auto& [ stem_id, stem_ptr ] : _stems) {
-        if (!stem_ptr->data_ready || stem_ptr->deleted) {
-            continue;
-        }
+    // Enter the read-side critical section, see `_render_list`
+    _render_epoch.fetch_add(1);
+    const RenderList& list = *_render_list.load();
+
+    _pcm_cache->tick();
+    _render_stamp = _pcm_cache->now();
+
+    int partitions = 1;
+    if (parallel) {
+        partitions = std::clamp(
+            static_cast<int>(list.size()) / MIN_STEMS_PER_PARTITION, 
+            1, _render_pool->max_partitions());
+    }
 
-        if (!stem_audible(stem_id)) {
-            continue;
+    if (partitions == 1) {
+        for (const StemEntryPtr& stem : list) {
+            render_stem(*stem, first_sample, block);
         }
-
-        std::lock_guard lock(stem_ptr->mutex);
-        int stem_sample = first_sample - stem_ptr->info.offset;
-        int stem_length = stem_ptr->info.samples;
-        float gain = Utils::decibels_to_gain(stem_ptr->info.gain_db);
-        float pan = stem_ptr->info.pan;
-        if (pan < -1.f) pan = -1.f;
-        if (pan > 1.f) pan = 1.f;
-
-        // Linear pan law
-        float gain_l = 1 - pan;
-        float gain_r = 1 + pan;
-
-        for (int i = 0; i < AUDIO_CHUNK_SAMPLES; ++i, ++stem_sample) {
-            if (stem_sample < 0 || stem_sample >= stem_length) {
-                continue;
+    } else {
+        _rendered_list = &list;
+        _render_first_sample = first_sample;
+        _render_frames = block.frames;
+        _render_partitions = partitions;
+        _render_pool->run(partitions);
+
+        // Always sum partial buses in the same order, so that the output
+        // doesn't depend on which worker finished first
+        for (int partition = 0; partition < partitions; ++partition) {
+            const audio_block& partial = _partial_buses[partition];
+
+            for (int i = 0; i < block.frames; ++i) {
+                block.left_channel[i] += partial.left_channel[i];
+                block.right_channel[i] += partial.right_channel[i];
             }
-
-            chunk.left_channel[i] 
-                += stem_ptr->data[2 * stem_sample] * SHORT_TO_FLOAT * gain * gain_l;
-            chunk.right_channel[i] 
-                += stem_ptr->data[2 * stem_sample + 1] * SHORT_TO_FLOAT * gain * gain_r;
         }
     }
+
+    _render_epoch.fetch_add(1);
+
+    // Wake the decode-ahead thread when playback moves on to the next block,
+    // or if a lazy stem has just been skipped because it wasn't cached
+    uint32_t playhead_block = first_sample / PcmBlockCache::BLOCK_FRAMES;
+    _playhead.store(first_sample, std::memory_order_relaxed);
+
+    if (_pcm_cache_missed.exchange(false) || playhead_block != _playhead_block) {
+        _playhead_block = playhead_block;
+        _decode_ahead_signal.fetch_add(1);
+        _decode_ahead_signal.notify_one();
+    }
 }
 
 void StemManager::update_stem_info(const std::vector<stem_info>& info)
 {
+    reclaim_render_lists();
     erase_unused_stems(info);
     update_or_add_stems(info);
 }
 
+void StemManager::set_playhead(uint32_t sample)
+{
+    // Waiting stems are ranked when a worker picks the next one, lazy stems
+    // get the blocks around the new position decoded even while paused
+    _playhead.store(sample, std::memory_order_relaxed);
+    _decode_ahead_signal.fetch_add(1);
+    _decode_ahead_signal.notify_one();
+}
+
+void StemManager::set_lazy_decoding(bool enabled)
+{
+    _lazy_decoding = enabled;
+}
+
+bool StemManager::lazy_decoding() const
+{
+    return _lazy_decoding;
+}
+
+void StemManager::set_pcm_cache_size(size_t bytes)
+{
+    _pcm_cache->set_capacity(bytes);
+}
+
+size_t StemManager::pcm_cache_size() const
+{
+    return _pcm_cache->capacity();
+}
+
+void StemManager::set_stem_cache(std::shared_ptr<StemCache> files, 
+    std::shared_ptr<StemCache> decoded)
+{
+    _stem_cache = std::move(files);
+    _decoded_stem_cache = std::move(decoded);
+}
+
+void StemManager::set_stem_cache_size(uint64_t bytes)
+{
+    if (_stem_cache) {
+        _stem_cache->set_capacity(bytes);
+    }
+}
+
+uint64_t StemManager::stem_cache_size() const
+{
+    return _stem_cache ? _stem_cache->capacity() : 0;
+}
+
+void StemManager::set_decoded_stem_cache_size(uint64_t bytes)
+{
+    if (_decoded_stem_cache) {
+        _decoded_stem_cache->set_capacity(bytes);
+    }
+}
+
+uint64_t StemManager::decoded_stem_cache_size() const
+{
+    return _decoded_stem_cache ? _decoded_stem_cache->capacity() : 0;
+}
+
+void StemManager::set_retained_stems_size(size_t bytes)
+{
+    _retained_stems_capacity = bytes;
+    evict_retained_stems();
+}
+
+size_t StemManager::retained_stems_size() const
+{
+    return _retained_stems_capacity;
+}
+
+task_pool_stats StemManager::task_stats() const
+{
+    return _task_pool->stats();
+}
+
 void StemManager::switch_to_mute_mode()
 {
     std::unordered_set<uint32_t> new_muted_stems;
@@ -188,6 +358,140 @@ void StemManager::switch_to_mute_mode()
     std::lock_guard lock(_mutex);
     _muted_stems = std::move(new_muted_stems);
     _soloed_stem = nullopt;
+
+    rebuild_render_list_locked();
+}
+
+void StemManager::rebuild_render_list_locked()
+{
+    auto list = std::make_unique<RenderList>();
+    for (const auto& [ stem_id, stem_ptr ] : _stems) {
+        stem_ptr->audible = stem_audible(stem_id);
+
+        if (stem_ptr->deleted || stem_ptr->error) {
+            continue;
+        }
+
+        if (!stem_ptr->audible) {
+            continue;
+        }
+
+        list->push_back(stem_ptr);
+    }
+
+    // Keep the order (and so the render partitions) stable between rebuilds
+    std::sort(list->begin(), list->end(), [](const StemEntryPtr& a, const StemEntryPtr& b) {
+        return a->info.id < b->info.id;
+    });
+
+    RenderList* old_list = _render_list.exchange(list.release());
+    _retired_lists.push_back({
+        .list = std::unique_ptr<RenderList>(old_list),
+        .render_epoch = _render_epoch.load(),
+    });
+
+    reclaim_render_lists_locked();
+}
+
+void StemManager::reclaim_render_lists()
+{
+    // Lists retired during a render wait for a later call, the mixer
+    // can't free them
+    std::lock_guard lock(_mutex);
+    reclaim_render_lists_locked();
+}
+
+void StemManager::reclaim_render_lists_locked()
+{
+    uint32_t render_epoch = _render_epoch.load();
+
+    // If no render was in progress or the counter has moved since then,
+    // the mixer can't be using the list anymore
+    std::erase_if(_retired_lists, [render_epoch](const retired_render_list& retired) {
+        return (retired.render_epoch & 1) == 0 || retired.render_epoch != render_epoch;
+    });
+}
+
+void StemManager::render_partition(int partition)
+{
+    audio_span partial(_partial_buses[partition], _render_frames);
+    for (int i = 0; i < partial.frames; ++i) {
+        partial.left_channel[i] = 0;
+        partial.right_channel[i] = 0;
+    }
+
+    // Contiguous ranges keep stems in the same partition between chunks
+    const RenderList& list = *_rendered_list;
+    size_t stems = list.size();
+    size_t begin = stems * partition / _render_partitions;
+    size_t end = stems * (partition + 1) / _render_partitions;
+
+    for (size_t i = begin; i < end; ++i) {
+        render_stem(*list[i], _render_first_sample, partial);
+    }
+}
+
+void StemManager::publish_stem_params_locked(StemEntry& stem)
+{
+    // The stem mutex makes sure there's only one writer at a time
+    float gain = Utils::decibels_to_gain(stem.info.gain_db);
+    float pan = stem.info.pan;
+    if (pan < -1.f) pan = -1.f;
+    if (pan > 1.f) pan = 1.f;
+
+    // Linear pan law
+    float gain_l = SHORT_TO_FLOAT * gain * (1 - pan);
+    float gain_r = SHORT_TO_FLOAT * gain * (1 + pan);
+
+    stem.params.store({
+        .gain_l = gain_l,
+        .gain_r = gain_r,
+        .offset = stem.info.offset,
+        .samples = stem.info.samples,
+        .kernel = MixKernels::select(stem.mono, gain_l, gain_r),
+    });
+}
+
+void StemManager::render_stem(const StemEntry& stem, uint32_t first_sample, const audio_span& block)
+{
+    stem_params params = stem.params.load();
+    int64_t stem_sample = static_cast<int64_t>(first_sample) - params.offset;
+
+    if (!params.kernel) {
+        return;
+    }
+
+    // Clip the block to the part that overlaps the stem and has been decoded
+    const StemStorage& storage = stem.storage;
+    int64_t available = std::min(params.samples, storage.available_frames());
+    int64_t begin = std::max<int64_t>(0, -stem_sample);
+    int64_t end = std::min<int64_t>(block.frames, available - stem_sample);
+    if (begin >= end) {
+        return;
+    }
+
+    // Walk the span segment by segment, silent ones are skipped
+    uint32_t frame = stem_sample + begin;
+    int64_t output = begin;
+
+    while (output < end) {
+        uint32_t segment_frame = frame % StemStorage::SEGMENT_FRAMES;
+        uint32_t count = std::min<int64_t>(end - output, StemStorage::SEGMENT_FRAMES - segment_frame);
+        const int16_t* segment = storage.segment(frame / StemStorage::SEGMENT_FRAMES);
+
+        if (storage.silence().silent(frame, count)) {
+            // nothing to mix
+        } else if (segment) {
+            storage.touch(frame / StemStorage::SEGMENT_FRAMES, _render_stamp);
+            params.kernel(segment + 2 * segment_frame, count, params.gain_l, params.gain_r, 
+                block.left_channel + output, block.right_channel + output);
+        } else if (storage.lazy()) {
+            _pcm_cache_missed.store(true, std::memory_order_relaxed);
+        }
+
+        frame += count;
+        output += count;
+    }
 }
 
 void StemManager::erase_unused_stems(const std::vector<stem_info>& info)
@@ -203,7 +507,15 @@ void StemManager::erase_unused_stems(const std::vector<stem_info>& info)
 
     std::lock_guard lock(_mutex); // <-- write access
     for (uint32_t id : ids_to_remove) {
-        _stems[id]->deleted = true;
+        StemEntryPtr& stem_ptr = _stems[id];
+
+        // Only complete stems are worth keeping, the rest stops loading
+        if (stem_ptr->data_ready && !stem_ptr->error) {
+            _retained_stems.push_back(stem_ptr);
+        } else {
+            stem_ptr->deleted = true;
+        }
+
         _stems.erase(id);
 
         _muted_stems.erase(id);
@@ -211,30 +523,41 @@ void StemManager::erase_unused_stems(const std::vector<stem_info>& info)
             _soloed_stem = nullopt;
         }
     }
+
+    if (!ids_to_remove.empty()) {
+        rebuild_render_list_locked();
+        evict_retained_stems();
+    }
 }
 
 void StemManager::update_or_add_stems(const std::vector<stem_info>& info)
 {
     std::vector<StemEntryPtr> stems_to_add;
+    std::vector<const stem_info*> stems_to_create;
 
     for (const auto& stem_info : info) {
         auto stem = _stems.find(stem_info.id);
 
         if (stem == _stems.end()) {
-            stems_to_add.push_back(create_stem_from_info(stem_info));
+            if (StemEntryPtr retained = reattach_retained_stem(stem_info)) {
+                stems_to_add.push_back(retained);
+            } else {
+                stems_to_create.push_back(&stem_info);
+            }
+
             continue;
         }
 
         auto& stem_ptr = stem->second;
 
-        // Redundantly check if something changed because the last thing we
-        // want is to carelessly take the mutex and block the audio thread
+        // The mixer only sees a new parameter snapshot, never locks
         if (stem_ptr->info.gain_db != stem_info.gain_db
             || stem_ptr->info.pan != stem_info.pan) {
 
             std::lock_guard lock(stem_ptr->mutex);
             stem_ptr->info.gain_db = stem_info.gain_db;
             stem_ptr->info.pan = stem_info.pan;
+            publish_stem_params_locked(*stem_ptr);
         }
 
         // invalidate waveform image if offset changed
@@ -245,6 +568,7 @@ void StemManager::update_or_add_stems(const std::vector<stem_info>& info)
                 stem_ptr->info.offset = stem_info.offset;
                 stem_ptr->waveform_base64.clear();
                 prev_ordinal = ++stem_ptr->waveform_ordinal;
+                publish_stem_params_locked(*stem_ptr);
             }
 
             _complete_cb();
@@ -252,11 +576,29 @@ void StemManager::update_or_add_stems(const std::vector<stem_info>& info)
         }
     }
 
+    // The heap doesn't grow: stems kept for later make room for new ones
+    // before any of their storage is allocated. At most this much, lazy
+    // stems take less.
+    size_t incoming_bytes = 0;
+    for (const stem_info* new_info : stems_to_create) {
+        incoming_bytes += static_cast<size_t>(new_info->samples) * 2 * sizeof(int16_t);
+    }
+
+    reclaim_render_lists(); // the one that had the closed song's stems, if it can be
+    evict_retained_stems(incoming_bytes);
+
+    for (const stem_info* new_info : stems_to_create) {
+        stems_to_add.push_back(create_stem_from_info(*new_info));
+    }
+
     if (!stems_to_add.empty()) {
         std::lock_guard lock(_mutex); // <-- write access
         for (StemEntryPtr& new_stem : stems_to_add) {
             _stems[new_stem->info.id] = new_stem;
         }
+
+        // New stems start playing as soon as their first segment is decoded
+        rebuild_render_list_locked();
     }
 }
 
@@ -264,141 +606,557 @@ auto StemManager::create_stem_from_info(const stem_info& info) -> StemEntryPtr
 {
     StemEntryPtr new_stem = std::make_shared<StemEntry>();
     new_stem->info = info;
-    new_stem->data = nullptr;
-    new_stem->data_block = "";
     new_stem->data_ready = false;
     new_stem->deleted = false;
     new_stem->error = false;
     new_stem->waveform_ordinal = 0;
     new_stem->waveform_base64 = "";
+    new_stem->mono = false;
+    new_stem->audible = stem_audible(info.id);
+    new_stem->storage.reset(info.samples, _lazy_decoding ? _pcm_cache : nullptr);
+    new_stem->cache = _stem_cache;
+    new_stem->decoded_cache = _decoded_stem_cache;
+    new_stem->file_bytes = 0;
+    publish_stem_params_locked(*new_stem); // not shared with anyone yet
 
     run_stem_processing(new_stem);
 
     return new_stem;
 }
 
+auto StemManager::reattach_retained_stem(const stem_info& info) -> StemEntryPtr
+{
+    auto retained = std::find_if(_retained_stems.begin(), _retained_stems.end(),
+        [&info](const StemEntryPtr& stem) {
+            return stem->info.path == info.path && stem->info.samples == info.samples;
+        });
+
+    if (retained == _retained_stems.end()) {
+        return nullptr;
+    }
+
+    StemEntryPtr stem = *retained;
+    _retained_stems.erase(retained);
+    printf("Stem %u: Reusing the decoded data of \"%s\".\n", info.id, info.path.c_str());
+
+    // Only the placement in the song may differ, so only the waveform is redrawn
+    uint32_t prev_ordinal;
+    {
+        std::lock_guard lock(stem->mutex);
+        stem->info = info;
+        stem->audible = stem_audible(info.id);
+        stem->waveform_base64.clear();
+        prev_ordinal = ++stem->waveform_ordinal;
+        publish_stem_params_locked(*stem);
+    }
+
+    run_waveform_processing(stem, prev_ordinal);
+    return stem;
+}
+
+void StemManager::evict_retained_stems(size_t incoming_bytes)
+{
+    size_t used = 0;
+    for (const StemEntryPtr& stem : _retained_stems) {
+        used += memory_bytes(*stem);
+    }
+
+    while (!_retained_stems.empty() && used > _retained_stems_capacity) {
+        used -= memory_bytes(*_retained_stems.front());
+        evict_oldest_retained_stem();
+    }
+
+    // A render list, a waveform task or the decode-ahead thread may still
+    // hold on to an evicted stem for a while, so the free heap is measured
+    // only once and the shortfall is covered by the stems' own sizes
+    size_t wanted_bytes = incoming_bytes + emscripten_get_heap_max() / FREE_HEAP_DIVISOR;
+    size_t free_bytes = free_heap_bytes();
+    size_t shortfall = wanted_bytes > free_bytes ? wanted_bytes - free_bytes : 0;
+
+    while (!_retained_stems.empty() && shortfall > 0) {
+        shortfall -= std::min(shortfall, memory_bytes(*_retained_stems.front()));
+        evict_oldest_retained_stem();
+    }
+}
+
+void StemManager::evict_oldest_retained_stem()
+{
+    // Its audio is freed along with the last reference
+    StemEntryPtr& evicted = _retained_stems.front();
+    printf("Stem %u: Dropping the decoded data of \"%s\".\n", 
+        evicted->info.id, evicted->info.path.c_str());
+
+    evicted->deleted = true;
+    _retained_stems.erase(_retained_stems.begin());
+}
+
+size_t StemManager::free_heap_bytes()
+{
+    size_t allocated = mallinfo().uordblks;
+    size_t heap = emscripten_get_heap_max();
+    return heap > allocated ? heap - allocated : 0;
+}
+
+size_t StemManager::memory_bytes(const StemEntry& stem)
+{
+    // Decoded blocks of lazy stems are in the PCM cache, bounded on its own
+    return stem.storage.lazy() ? stem.file_bytes : stem.storage.stored_bytes();
+}
+
 void StemManager::run_stem_processing(StemEntryPtr stem)
 {
     auto cb = _complete_cb;
 
-    std::thread thread([this, stem, cb]() {
+    auto task = [this, stem, cb]() {
         process_stem(stem);
         cb();
-    });
+    };
 
-    thread.detach();
+    // Only as many stems load at once as there are workers, the rest wait
+    // in the order of the current playhead
+    auto rank = [this, stem = stem.get()]() { return load_rank(*stem); };
+
+    _task_pool->submit(TaskPool::Priority::DECODE, task, [stem]() { return stem->deleted.load(); },
+        0, rank);
+}
+
+int64_t StemManager::load_rank(const StemEntry& stem) const
+{
+    stem_params params = stem.params.load();
+    int64_t playhead = _playhead.load(std::memory_order_relaxed);
+    int64_t begin = params.offset;
+    int64_t end = begin + params.samples;
+
+    // Stems playing right now come first, then those starting soonest.
+    // Stems that are over already are only needed after seeking back.
+    int64_t rank = 0;
+    if (playhead < begin) {
+        rank = begin - playhead;
+    } else if (playhead >= end) {
+        rank = PASSED_STEM_RANK + (playhead - end);
+    }
+
+    if (!stem.audible) {
+        rank += MUTED_STEM_RANK;
+    }
+
+    return rank;
 }
 
 void StemManager::run_waveform_processing(StemEntryPtr stem, uint32_t prev_ordinal)
 {
     auto cb = _complete_cb;
 
-    std::thread thread([this, stem, cb, prev_ordinal]() {
+    auto task = [this, stem, cb, prev_ordinal]() {
         process_stem_waveform(stem, prev_ordinal);
         cb();
-    });
-    
-    thread.detach();
+    };
+
+    // Obsolete before it even started. A stem that isn't decoded yet gets
+    // its waveform drawn with the latest ordinal once it is.
+    auto cancelled = [stem, prev_ordinal]() {
+        return stem->deleted || !stem->data_ready || stem->waveform_ordinal != prev_ordinal;
+    };
+
+    // Only the latest image of a stem is worth drawing
+    uint64_t coalesce_key = static_cast<uint64_t>(stem->info.id) + 1;
+    _task_pool->submit(TaskPool::Priority::WAVEFORM, task, cancelled, coalesce_key);
 }
 
 void StemManager::process_stem(StemEntryPtr stem)
 {
-    using namespace std::chrono_literals;
+    uint32_t sid = stem->info.id;
+
+    if (!restore_decoded_stem(stem) && !download_and_decode_stem(stem)) {
+        return;
+    }
+
+    if (stem->deleted) return;
+
+    if (stem->storage.dual_mono()) {
+        printf("Stem %u: Both channels are identical, mixing as mono.\n", sid);
+
+        std::lock_guard lock(stem->mutex);
+        stem->mono = true;
+        publish_stem_params_locked(*stem);
+    }
+
+    const StemStorage& storage = stem->storage;
+    if (storage.lazy()) {
+        printf("Stem %u: %u of %u blocks are silent, decoded audio is cached on demand.\n", 
+            sid, storage.silence().silent_blocks(), storage.silence().total_blocks());
+    } else {
+        printf("Stem %u: %u of %u blocks are silent, keeping %zu of %zu kB in memory.\n", 
+            sid, storage.silence().silent_blocks(), storage.silence().total_blocks(),
+            storage.stored_bytes() / 1024, storage.dense_bytes() / 1024);
+    }
+
+    // The offset or track length might have changed in the meantime
+    uint32_t prev_ordinal;
+    {
+        std::lock_guard lock(stem->mutex);
+        stem->data_ready = true;
+        prev_ordinal = stem->waveform_ordinal;
+    }
+
+    run_waveform_processing(stem, prev_ordinal);
+}
 
+bool StemManager::restore_decoded_stem(StemEntryPtr stem)
+{
+    // Lazy stems need the compressed file anyway
+    if (!stem->decoded_cache || stem->storage.lazy()) {
+        return false;
+    }
+
+    std::vector<uint8_t> snapshot;
+    if (!stem->decoded_cache->load(stem->info.path, snapshot)) {
+        return false;
+    }
+
+    if (!stem->storage.restore(snapshot)) {
+        // Of another length, the stem must have been replaced
+        stem->decoded_cache->remove(stem->info.path);
+        return false;
+    }
+
+    printf("Stem %u: Restored %zu kB of decoded audio from the cache.\n", 
+        stem->info.id, snapshot.size() / 1024);
+    return true;
+}
+
+bool StemManager::download_and_decode_stem(StemEntryPtr stem)
+{
     uint32_t sid = stem->info.id;
-    emscripten_fetch_t* fetch = nullptr;
+    printf("Stem %u: Downloading \"%s\"\n", sid, stem->info.path.c_str());
+
+    // The download runs on a helper thread, so that decoding never holds it
+    // up. Without a free helper, the whole file is downloaded first.
+    stem_download download;
+    TaskPool::HelperJob download_job = _task_pool->try_run_helper([this, stem, &download]() {
+        download_stem(stem, download);
+    });
+
+    if (!download_job) {
+        download_stem(stem, download);
+    }
+
+    const stem_codec& codec = find_codec(stem->info.format);
+    bool decoded_ok = decode_stem(stem, download);
+    download.abort = true;
+
+    if (download_job) {
+        _task_pool->wait_helper(download_job);
+    }
+
+    if (stem->deleted) return false;
+
+    if (download.failed) {
+        fprintf(stderr, "Stem %u: Download failed completely!\n", sid);
+        mark_stem_failed(stem);
+        return false;
+    }
 
-    emscripten_fetch_attr_t attr;
-    emscripten_fetch_attr_init(&attr);
-    strcpy(attr.requestMethod, "GET");
-    attr.attributes = EMSCRIPTEN_FETCH_LOAD_TO_MEMORY | EMSCRIPTEN_FETCH_SYNCHRONOUS;
+    if (!decoded_ok) {
+        fprintf(stderr, "Stem %u: %s decoding failed!\n", sid, codec.name);
+        mark_stem_failed(stem);
 
-    for (int approach = 0; approach < STEM_DOWNLOAD_RETRY_COUNT; ++approach) {
-        printf("Stem %u: Downloading \"%s\"\n", sid, stem->info.path.c_str());
+        if (stem->cache && download.from_cache) {
+            stem->cache->remove(stem->info.path);
+        }
 
-        fetch = emscripten_fetch(&attr, stem->info.path.c_str());
+        return false;
+    }
 
-        if (fetch->status < 200 || fetch->status > 299) {
-            // If download failed...
+    printf("Stem %u: %s data has been decoded.\n", sid, codec.name);
 
-            fprintf(stderr, "Stem %u: Download failed! Retrying %d more time(s)...\n", 
-                sid, STEM_DOWNLOAD_RETRY_COUNT - approach - 1);
-            emscripten_fetch_close(fetch);
+    if (stem->storage.lazy()) {
+        // Evicted blocks are decoded again from the compressed file.
+        // Both formats find any block by bisection (over Ogg page granule
+        // positions or FLAC frame headers), the file is the seek table.
+        std::shared_ptr<const std::vector<uint8_t>> file = download.data;
+        stem->file_bytes = file->size();
+        const std::atomic_bool& deleted = stem->deleted;
+        StreamDecoder::RangeDecoder decode_range = codec.decode_range;
 
-            if (approach + 1 == STEM_DOWNLOAD_RETRY_COUNT) {
-                fprintf(stderr, "Stem %u: Download failed completely!\n", sid);
-                stem->error = true;
+        stem->storage.set_loader([file, &deleted, decode_range](StemStorage::Writer& writer) {
+            return decode_range(file->data(), file->size(), writer, deleted);
+        });
+    }
+
+    // Only stems that decode fine are kept for later sessions
+    if (stem->cache && !download.from_cache) {
+        stem->cache->store(stem->info.path, *download.data);
+    }
+
+    // Decoded audio is several times larger, it's only kept if it doesn't
+    // push out the rest of the song (the file is there either way)
+    std::vector<uint8_t> snapshot;
+    if (stem->decoded_cache && stem->storage.save(snapshot)
+        && stem->decoded_cache->store(stem->info.path, snapshot, true)) {
+        printf("Stem %u: Cached %zu kB of decoded audio.\n", sid, snapshot.size() / 1024);
+    }
 
-                return;
+    return true;
+}
+
+void StemManager::download_stem(StemEntryPtr stem, stem_download& download)
+{
+    // A cached file arrives complete, so it's decoded in parallel right away
+    auto cached = std::make_shared<std::vector<uint8_t>>();
+    if (stem->cache && stem->cache->load(stem->info.path, *cached)) {
+        printf("Stem %u: Loaded %zu bytes from the cache.\n", stem->info.id, cached->size());
+
+        std::lock_guard lock(download.mutex);
+        download.data = cached;
+        download.from_cache = true;
+        download.finished = true;
+        download.data_arrived.notify_one();
+        return;
+    }
+
+    RangeDownloader downloader(stem->info.path, STREAM_CHUNK_BYTES, DOWNLOAD_CONNECTIONS,
+        STEM_DOWNLOAD_RETRY_COUNT, [stem, &download]() { return stem->deleted || download.abort; },
+        *_task_pool);
+
+    std::vector<uint8_t> chunk;
+    while (downloader.next(chunk)) {
+        std::lock_guard lock(download.mutex);
+        if (download.data->empty()) {
+            download.data->reserve(downloader.total_bytes());
+        }
+
+        download.data->insert(download.data->end(), chunk.begin(), chunk.end());
+        download.data_arrived.notify_one();
+    }
+
+    if (!downloader.failed()) {
+        printf("Stem %u: Download finished. Got %llu bytes.\n", 
+            stem->info.id, downloader.downloaded_bytes());
+    }
+
+    std::lock_guard lock(download.mutex);
+    download.finished = true;
+    download.failed = downloader.failed();
+    download.data_arrived.notify_one();
+}
+
+bool StemManager::decode_stem(StemEntryPtr stem, stem_download& download)
+{
+    StemStorage& storage = stem->storage;
+    StemStorage::Writer writer(storage, 0, storage.frames());
+    const stem_codec& codec = find_codec(stem->info.format);
+    std::unique_ptr<StreamDecoder> decoder = codec.create_decoder(writer);
+
+    std::vector<std::unique_ptr<StemStorage::Writer>> range_writers;
+    std::vector<TaskPool::HelperJob> range_jobs;
+    std::vector<int> inline_ranges; // no helper was free for them
+    std::atomic<int> failed_ranges = 0;
+
+    std::vector<uint8_t> chunk;
+    size_t fed_bytes = 0;
+    bool decoded_ok = true;
+    bool playable = false;
+    bool split = false;
+
+    // Every chunk is decoded as soon as it arrives. The mixer plays whatever
+    // is below the storage watermark, so playback doesn't wait for the rest.
+    while (decoded_ok && !writer.complete() && !stem->deleted) {
+        bool finished;
+        {
+            std::unique_lock lock(download.mutex);
+            download.data_arrived.wait(lock, [&download, fed_bytes]() { 
+                return download.finished || download.data->size() > fed_bytes; 
+            });
+
+            if (download.failed) {
+                return false;
             }
 
-            // Wait before next download try
-            std::this_thread::sleep_for(3s);
+            chunk.assign(download.data->begin() + fed_bytes, download.data->end());
+            finished = download.finished;
+        }
 
-            if (stem->deleted) {
-                return;
+        if (finished && !split) {
+            // The whole file is here: the rest of the stem, from the next
+            // commit boundary on, is split into ranges decoded in parallel
+            // by helpers. This thread finishes the current one and takes the
+            // last range, and any range no helper was free for.
+            split = true;
+
+            const uint32_t step = storage.commit_frames();
+            uint32_t first = std::min(storage.frames(), 
+                (writer.position() + step - 1) / step * step);
+            uint32_t remaining = storage.frames() - first;
+            int wanted = std::min<uint32_t>(remaining / PARALLEL_DECODE_MIN_FRAMES, MAX_DECODE_RANGES);
+            int ranges = reserve_decode_threads(wanted - 1) + 1;
+
+            if (ranges > 1) {
+                printf("Stem %u: Decoding the remaining %u frames in %d ranges.\n", 
+                    stem->info.id, remaining, ranges);
+
+                // Ranges start at commit boundaries, only the last one is shorter
+                auto range_start = [&storage, first, remaining, ranges, step](int range) -> uint32_t {
+                    if (range == ranges) return storage.frames();
+                    return first + uint64_t(remaining) * range / ranges / step * step;
+                };
+
+                writer.set_end(first);
+                for (int range = 0; range < ranges; ++range) {
+                    uint32_t begin = range_start(range);
+                    range_writers.push_back(std::make_unique<StemStorage::Writer>(
+                        storage, begin, range_start(range + 1) - begin));
+                }
+
+                for (int range = 0; range + 1 < ranges; ++range) {
+                    auto decode = [stem, &codec, &download, &range_writers, &failed_ranges, range]() {
+                        if (!codec.decode_range(download.data->data(), 
+                            download.data->size(), *range_writers[range], stem->deleted)) {
+                            ++failed_ranges;
+                        }
+                    };
+
+                    TaskPool::HelperJob job = _task_pool->try_run_helper(decode);
+                    if (job) {
+                        range_jobs.push_back(std::move(job));
+                    } else {
+                        inline_ranges.push_back(range);
+                    }
+                }
+
+                release_decode_threads(inline_ranges.size());
             }
-        } else {
-            // If download was successful...
+        }
+
+        if (chunk.empty()) {
+            break; // the download is finished and everything has been fed
+        }
+
+        fed_bytes += chunk.size();
+        decoded_ok = decoder->feed(chunk.data(), chunk.size());
+
+        if (!playable && storage.available_frames() > 0) {
+            printf("Stem %u: Playable after %zu bytes, decoding the rest while downloading...\n", 
+                stem->info.id, fed_bytes);
+            playable = true;
+        }
+    }
+
+    decoded_ok = decoded_ok && decoder->finish();
 
-            if (stem->deleted) {
-                emscripten_fetch_close(fetch);
-                return;
+    if (!range_writers.empty()) {
+        inline_ranges.push_back(range_writers.size() - 1);
+        for (int range : inline_ranges) {
+            if (decoded_ok) {
+                decoded_ok = codec.decode_range(download.data->data(), download.data->size(), 
+                    *range_writers[range], stem->deleted);
             }
+        }
 
-            break;
+        for (const TaskPool::HelperJob& job : range_jobs) {
+            _task_pool->wait_helper(job);
         }
+
+        release_decode_threads(range_jobs.size());
     }
 
-    printf("Stem %u: Download finished. Got %llu bytes. Starting vorbis decoder...\n", 
-        sid, fetch->numBytes);
+    return decoded_ok && failed_ranges == 0 && storage.complete();
+}
 
-    bool vorbis_ok = decode_vorbis_stream(stem, fetch->data, fetch->numBytes);
-    emscripten_fetch_close(fetch);
+int StemManager::reserve_decode_threads(int wanted)
+{
+    int busy = _decode_threads.load();
+    int granted;
 
-    if (stem->deleted) return;
+    do {
+        granted = std::clamp(_decode_thread_limit - busy, 0, std::max(0, wanted));
+    } while (granted > 0 && !_decode_threads.compare_exchange_weak(busy, busy + granted));
 
-    if (vorbis_ok) {
-        printf("Stem %u: Vorbis data has been decoded.\n", sid);
+    return granted;
+}
 
-        stem->data_ready = true;
-        process_stem_waveform(stem, 0);
+void StemManager::release_decode_threads(int threads)
+{
+    _decode_threads.fetch_sub(threads);
+}
 
-        printf("Stem %u: Initial waveform image has been generated.\n", sid);
-    } else {
-        fprintf(stderr, "Stem %u: Vorbis decoding failed!\n", sid);
-        stem->error = true;
-    }
+void StemManager::mark_stem_failed(StemEntryPtr stem)
+{
+    // Don't leave a partially decoded stem playing
+    stem->error = true;
+
+    std::lock_guard lock(_mutex);
+    rebuild_render_list_locked();
 }
 
-bool StemManager::decode_vorbis_stream(
-    StemEntryPtr stem, const char* data, uint32_t data_size)
+void StemManager::decode_ahead_main()
 {
-    stem->data_block.resize(2 * stem->info.samples * sizeof(int16_t));
+    uint32_t signal = 0;
 
-    const unsigned char* in_data = reinterpret_cast<const unsigned char*>(data);
-    int16_t* out_data = reinterpret_cast<int16_t*>(stem->data_block.data());
-    stem->data = out_data;
+    while (true) {
+        _decode_ahead_signal.wait(signal);
+        signal = _decode_ahead_signal.load();
 
-    int samples_processed = 0;
-    int vorbis_error = 0;
-    int limit = 2 * stem->info.samples;
+        if (_decode_ahead_quit) {
+            return;
+        }
 
-    stb_vorbis* vorbis = stb_vorbis_open_memory(in_data, data_size, &vorbis_error, NULL);
-    if (vorbis == nullptr) {
-        stem->data_block.clear();
-        return false;
-    }
+        std::vector<StemEntryPtr> stems;
+        {
+            // The mixer wakes this thread regularly, a good time to free
+            // the lists it has finished with
+            std::lock_guard lock(_mutex);
+            reclaim_render_lists_locked();
+
+            for (const StemEntryPtr& stem : *_render_list.load()) {
+                if (stem->storage.lazy()) {
+                    stems.push_back(stem);
+                }
+            }
+        }
+
+        // Nearest blocks of all stems first. Start over as soon as the
+        // mixer signals again, the playhead might have jumped.
+        const int64_t block_frames = PcmBlockCache::BLOCK_FRAMES;
+        uint32_t playhead = _playhead.load(std::memory_order_relaxed);
+
+        for (uint32_t ahead = 0; ahead < DECODE_AHEAD_BLOCKS; ++ahead) {
+            for (const StemEntryPtr& stem : stems) {
+                if (_decode_ahead_signal.load() != signal) {
+                    break;
+                }
 
-    int samples;
-    while ((samples = stb_vorbis_get_frame_short_interleaved(
-        vorbis, 2, out_data + samples_processed, limit - samples_processed))) {
+                stem_params params = stem->params.load();
+                int64_t stem_frame = static_cast<int64_t>(playhead) - params.offset 
+                    + ahead * block_frames;
 
-        samples_processed += 2 * samples;
+                if (stem_frame > -block_frames && stem_frame < stem->storage.frames()) {
+                    stem->storage.load_block(std::max<int64_t>(0, stem_frame) / block_frames);
+                }
+            }
+        }
     }
+}
 
-    stb_vorbis_close(vorbis);
-    return samples_processed == limit;
+auto StemManager::find_codec(const std::string& format) -> const stem_codec&
+{
+    static const stem_codec VORBIS = {
+        .name = "Vorbis",
+        .create_decoder = [](StemStorage::Writer& writer) -> std::unique_ptr<StreamDecoder> {
+            return std::make_unique<VorbisStreamDecoder>(writer);
+        },
+        .decode_range = &VorbisStreamDecoder::decode_range,
+    };
+
+    static const stem_codec FLAC = {
+        .name = "FLAC",
+        .create_decoder = [](StemStorage::Writer& writer) -> std::unique_ptr<StreamDecoder> {
+            return std::make_unique<FlacStreamDecoder>(writer);
+        },
+        .decode_range = &FlacStreamDecoder::decode_range,
+    };
+
+    return format == "flac" ? FLAC : VORBIS;
 }
 
 void StemManager::process_stem_waveform(StemEntryPtr stem, uint32_t prev_ordinal)
@@ -419,7 +1177,7 @@ void StemManager::process_stem_waveform(StemEntryPtr stem, uint32_t prev_ordinal
     }
 
     auto png = renderer.render_waveform_to_png(
-        stem_offset, track_length, stem->data, stem->info.samples);
+        stem_offset, track_length, stem->storage);
     std::string data_uri = "data:image/png;base64," + base64_encode(png.data(), png.size());
     
     {
@@ -0,0 +1,497 @@
+#include <stem-storage.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+
+const uint32_t StemStorage::SEGMENTS_PER_PAGE = 64; // up to 256 kB pages
+const uint32_t StemStorage::SNAPSHOT_MAGIC = 0x31535347; // "GSS1"
+
+/* Followed by a byte per segment (1 if stored) and the stored segments */
+struct snapshot_header {
+    uint32_t magic;
+    uint32_t frames;
+    uint32_t segment_frames;
+};
+
+StemStorage::Writer::Writer(StemStorage& storage, uint32_t first_frame, uint32_t frames)
+    : _storage(storage)
+    , _staging(std::make_unique<int16_t[]>(2 * storage.commit_frames()))
+    , _staging_frames(0)
+    , _output(nullptr)
+    , _position(first_frame)
+    , _end(first_frame + frames)
+{
+    assert(first_frame % storage.commit_frames() == 0);
+    assert(_end <= storage.frames());
+}
+
+StemStorage::Writer::Writer(StemStorage& storage, uint32_t first_frame, uint32_t frames,
+    int16_t* output)
+    : _storage(storage)
+    , _staging_frames(0)
+    , _output(output)
+    , _position(first_frame)
+    , _end(first_frame + frames)
+{
+    assert(_end <= storage.frames());
+}
+
+void StemStorage::Writer::append(const int16_t* samples, uint32_t frames)
+{
+    uint32_t commit_frames = _storage.commit_frames();
+    frames = std::min(frames, _end - _position);
+
+    if (_output) {
+        memcpy(_output, samples, 2 * frames * sizeof(int16_t));
+        _output += 2 * frames;
+        _position += frames;
+        return;
+    }
+
+    while (frames > 0) {
+        uint32_t count = std::min(frames, commit_frames - _staging_frames);
+        memcpy(_staging.get() + 2 * _staging_frames, samples, 2 * count * sizeof(int16_t));
+
+        _staging_frames += count;
+        _position += count;
+        samples += 2 * count;
+        frames -= count;
+
+        if (_staging_frames == commit_frames || _position == _end) {
+            _storage.commit(_position - _staging_frames, _staging.get(), _staging_frames);
+            _staging_frames = 0;
+        }
+    }
+}
+
+void StemStorage::Writer::set_end(uint32_t end_frame)
+{
+    assert(end_frame >= _position && end_frame <= _end);
+    assert(end_frame % _storage.commit_frames() == 0 || end_frame == _storage.frames());
+
+    // Staged frames never cross a commit boundary, so nothing is lost here
+    _end = end_frame;
+}
+
+bool StemStorage::Writer::complete() const
+{
+    return _position == _end;
+}
+
+uint32_t StemStorage::Writer::position() const
+{
+    return _position;
+}
+
+uint32_t StemStorage::Writer::end() const
+{
+    return _end;
+}
+
+StemStorage::StemStorage()
+    : _segment_count(0)
+    , _committed_segments(0)
+    , _committed_prefix(0)
+    , _page_segments(0)
+    , _page_capacity(0)
+    , _page_bytes(0)
+    , _frames(0)
+    , _available_frames(0)
+    , _dual_mono(true)
+{
+    assert(SEGMENT_FRAMES % SilenceIndex::BLOCK_FRAMES == 0);
+    assert(PcmBlockCache::BLOCK_FRAMES % SEGMENT_FRAMES == 0);
+}
+
+StemStorage::~StemStorage()
+{
+    if (_cache) {
+        _cache->release(*this);
+    }
+}
+
+void StemStorage::reset(uint32_t frames, std::shared_ptr<PcmBlockCache> cache)
+{
+    if (_cache) {
+        _cache->release(*this);
+    }
+
+    uint32_t segments = (frames + SEGMENT_FRAMES - 1) / SEGMENT_FRAMES;
+    uint32_t blocks = (frames + PcmBlockCache::BLOCK_FRAMES - 1) / PcmBlockCache::BLOCK_FRAMES;
+
+    std::lock_guard lock(_mutex);
+    _frames = frames;
+    _available_frames.store(0, std::memory_order_relaxed);
+    _segments = std::make_unique<std::atomic<const int16_t*>[]>(segments);
+    _segment_count = segments;
+    for (uint32_t i = 0; i < segments; ++i) {
+        _segments[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    _committed.assign(segments, false);
+    _committed_segments = 0;
+    _committed_prefix = 0;
+    _pages.clear();
+    _page_segments = 0;
+    _page_capacity = 0;
+    _page_bytes = 0;
+    _silence.reset((frames + SilenceIndex::BLOCK_FRAMES - 1) / SilenceIndex::BLOCK_FRAMES);
+    _dual_mono = true;
+
+    _cache = std::move(cache);
+    _loader = nullptr;
+    _resident_blocks.clear();
+    _block_stamps.reset();
+
+    if (_cache) {
+        _resident_blocks.assign(blocks, nullptr);
+        _block_stamps = std::make_unique<std::atomic<uint32_t>[]>(blocks);
+        for (uint32_t i = 0; i < blocks; ++i) {
+            _block_stamps[i].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+bool StemStorage::complete() const
+{
+    return available_frames() == _frames;
+}
+
+bool StemStorage::lazy() const
+{
+    return _cache != nullptr;
+}
+
+uint32_t StemStorage::commit_frames() const
+{
+    // Lazy storages hand whole cache blocks over at once
+    return _cache ? PcmBlockCache::BLOCK_FRAMES : SEGMENT_FRAMES;
+}
+
+uint32_t StemStorage::frames() const
+{
+    return _frames;
+}
+
+uint32_t StemStorage::available_frames() const
+{
+    return _available_frames.load(std::memory_order_acquire);
+}
+
+size_t StemStorage::stored_bytes() const
+{
+    return _page_bytes + _segment_count * sizeof(_segments[0]);
+}
+
+size_t StemStorage::dense_bytes() const
+{
+    return static_cast<size_t>(_frames) * 2 * sizeof(int16_t);
+}
+
+const SilenceIndex& StemStorage::silence() const
+{
+    return _silence;
+}
+
+bool StemStorage::dual_mono() const
+{
+    std::lock_guard lock(_mutex);
+    return _dual_mono;
+}
+
+void StemStorage::set_loader(Loader loader)
+{
+    std::lock_guard lock(_mutex);
+    _loader = std::move(loader);
+}
+
+bool StemStorage::load_block(uint32_t block)
+{
+    if (!_cache) {
+        return true;
+    }
+
+    uint32_t first = block * PcmBlockCache::BLOCK_FRAMES;
+    if (first >= _frames) {
+        return false;
+    }
+
+    uint32_t frames = std::min(PcmBlockCache::BLOCK_FRAMES, _frames - first);
+    if (first + frames > available_frames()) {
+        return false; // it hasn't been decoded for the first time yet
+    }
+
+    if (_silence.silent(first, frames) || _cache->resident(*this, block)) {
+        return true;
+    }
+
+    Loader loader;
+    {
+        std::lock_guard lock(_mutex);
+        loader = _loader;
+    }
+
+    if (!loader) {
+        return false;
+    }
+
+    Writer writer(*this, first, frames);
+    return loader(writer);
+}
+
+bool StemStorage::read(uint32_t first_frame, uint32_t frames, int16_t* output)
+{
+    while (frames > 0) {
+        uint32_t block = first_frame / PcmBlockCache::BLOCK_FRAMES;
+        uint32_t block_offset = first_frame % PcmBlockCache::BLOCK_FRAMES;
+        uint32_t count = std::min(frames, PcmBlockCache::BLOCK_FRAMES - block_offset);
+
+        if (!_cache) {
+            for (uint32_t frame = first_frame; frame < first_frame + count; ) {
+                uint32_t segment_offset = frame % SEGMENT_FRAMES;
+                uint32_t piece = std::min(first_frame + count - frame, SEGMENT_FRAMES - segment_offset);
+                const int16_t* data = segment(frame / SEGMENT_FRAMES);
+                int16_t* out = output + 2 * (frame - first_frame);
+
+                if (data) {
+                    memcpy(out, data + 2 * segment_offset, 2 * piece * sizeof(int16_t));
+                } else {
+                    memset(out, 0, 2 * piece * sizeof(int16_t));
+                }
+
+                frame += piece;
+            }
+        } else if (_silence.silent(first_frame, count)) {
+            memset(output, 0, 2 * count * sizeof(int16_t));
+        } else if (!_cache->read(*this, block, block_offset, count, output)) {
+            Loader loader;
+            {
+                std::lock_guard lock(_mutex);
+                loader = _loader;
+            }
+
+            // Evicted: decoded again straight into the output
+            Writer writer(*this, first_frame, count, output);
+            if (!loader || first_frame + count > available_frames() || !loader(writer)) {
+                return false;
+            }
+        }
+
+        first_frame += count;
+        output += 2 * count;
+        frames -= count;
+    }
+
+    return true;
+}
+
+bool StemStorage::save(std::vector<uint8_t>& snapshot) const
+{
+    if (_cache || !complete()) {
+        return false;
+    }
+
+    snapshot_header header = {
+        .magic = SNAPSHOT_MAGIC,
+        .frames = _frames,
+        .segment_frames = SEGMENT_FRAMES,
+    };
+
+    snapshot.resize(sizeof(header) + _segment_count);
+    memcpy(snapshot.data(), &header, sizeof(header));
+
+    for (uint32_t index = 0; index < _segment_count; ++index) {
+        const int16_t* data = segment(index);
+        snapshot[sizeof(header) + index] = data != nullptr;
+
+        if (data) {
+            uint32_t count = std::min(SEGMENT_FRAMES, _frames - index * SEGMENT_FRAMES);
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+            snapshot.insert(snapshot.end(), bytes, bytes + 2 * count * sizeof(int16_t));
+        }
+    }
+
+    return true;
+}
+
+bool StemStorage::restore(const std::vector<uint8_t>& snapshot)
+{
+    snapshot_header header;
+    if (_cache || available_frames() != 0 || snapshot.size() < sizeof(header)) {
+        return false;
+    }
+
+    memcpy(&header, snapshot.data(), sizeof(header));
+    if (header.magic != SNAPSHOT_MAGIC || header.frames != _frames 
+        || header.segment_frames != SEGMENT_FRAMES 
+        || snapshot.size() < sizeof(header) + _segment_count) {
+        return false;
+    }
+
+    // Check the size before writing anything
+    const uint8_t* stored = snapshot.data() + sizeof(header);
+    size_t data_bytes = 0;
+    for (uint32_t index = 0; index < _segment_count; ++index) {
+        if (stored[index]) {
+            uint32_t count = std::min(SEGMENT_FRAMES, _frames - index * SEGMENT_FRAMES);
+            data_bytes += 2 * count * sizeof(int16_t);
+        }
+    }
+
+    if (snapshot.size() != sizeof(header) + _segment_count + data_bytes) {
+        return false;
+    }
+
+    // Through a writer, so that the silence index and the watermark are
+    // built just like when decoding
+    const int16_t zeros[2 * SEGMENT_FRAMES] = {};
+    const uint8_t* data = stored + _segment_count;
+    Writer writer(*this, 0, _frames);
+
+    for (uint32_t index = 0; index < _segment_count; ++index) {
+        uint32_t count = std::min(SEGMENT_FRAMES, _frames - index * SEGMENT_FRAMES);
+
+        if (stored[index]) {
+            // Copied out, the snapshot data isn't aligned
+            int16_t samples[2 * SEGMENT_FRAMES];
+            memcpy(samples, data, 2 * count * sizeof(int16_t));
+            writer.append(samples, count);
+            data += 2 * count * sizeof(int16_t);
+        } else {
+            writer.append(zeros, count);
+        }
+    }
+
+    return true;
+}
+
+void StemStorage::commit(uint32_t first_frame, const int16_t* samples, uint32_t frames)
+{
+    std::lock_guard lock(_mutex);
+    uint32_t first_segment = first_frame / SEGMENT_FRAMES;
+    bool audible = false;
+
+    for (uint32_t offset = 0; offset < frames; offset += SEGMENT_FRAMES) {
+        uint32_t index = first_segment + offset / SEGMENT_FRAMES;
+        uint32_t count = std::min(SEGMENT_FRAMES, frames - offset);
+        const int16_t* data = samples + 2 * offset;
+
+        if (_cache) {
+            // Only the first decode of a lazy block indexes it, later
+            // ones just bring it back to the cache
+            if (!_committed[index]) {
+                index_segment_locked(index, data, count);
+            }
+
+            audible |= !_silence.silent(index * SEGMENT_FRAMES, count);
+        } else if (!index_segment_locked(index, data, count)) {
+            int16_t* segment = allocate_segment_locked();
+            memcpy(segment, data, 2 * count * sizeof(int16_t));
+            _segments[index].store(segment, std::memory_order_release);
+        }
+    }
+
+    if (audible) {
+        _cache->insert(*this, first_frame / PcmBlockCache::BLOCK_FRAMES, samples, frames);
+    }
+
+    advance_watermark_locked();
+}
+
+bool StemStorage::index_segment_locked(uint32_t index, const int16_t* samples, uint32_t frames)
+{
+    bool silent = true;
+
+    for (uint32_t first = 0; first < frames; first += SilenceIndex::BLOCK_FRAMES) {
+        uint32_t count = std::min(SilenceIndex::BLOCK_FRAMES, frames - first);
+        uint32_t block = (index * SEGMENT_FRAMES + first) / SilenceIndex::BLOCK_FRAMES;
+        silent &= _silence.store_block(block, samples + 2 * first, count);
+    }
+
+    for (uint32_t i = 0; _dual_mono && i < frames; ++i) {
+        _dual_mono = samples[2 * i] == samples[2 * i + 1];
+    }
+
+    _committed[index] = true;
+    ++_committed_segments;
+    return silent;
+}
+
+void StemStorage::advance_watermark_locked()
+{
+    uint32_t prefix = _committed_prefix;
+    while (prefix < _segment_count && _committed[prefix]) {
+        ++prefix;
+    }
+
+    if (prefix != _committed_prefix) {
+        _committed_prefix = prefix;
+
+        // Makes the segments and their silence bits visible to readers
+        uint32_t available = std::min(prefix * SEGMENT_FRAMES, _frames);
+        _available_frames.store(available, std::memory_order_release);
+    }
+}
+
+int16_t* StemStorage::allocate_segment_locked()
+{
+    if (_page_segments == _page_capacity) {
+        // Don't allocate more than the rest of the stem could ever need
+        uint32_t remaining_segments = _segment_count - _committed_segments + 1;
+        size_t page_size = static_cast<size_t>(std::min(SEGMENTS_PER_PAGE, remaining_segments))
+            * SEGMENT_FRAMES * 2;
+
+        _pages.push_back(std::make_unique<int16_t[]>(page_size));
+        _page_segments = 0;
+        _page_capacity = std::min(SEGMENTS_PER_PAGE, remaining_segments);
+        _page_bytes += page_size * sizeof(int16_t);
+    }
+
+    return _pages.back().get() + static_cast<size_t>(_page_segments++) * SEGMENT_FRAMES * 2;
+}
+
+const int16_t* StemStorage::resident_block(uint32_t block) const
+{
+    return _resident_blocks[block];
+}
+
+uint32_t StemStorage::block_stamp(uint32_t block) const
+{
+    return _block_stamps[block].load(std::memory_order_relaxed);
+}
+
+void StemStorage::stamp_block(uint32_t block, uint32_t stamp)
+{
+    _block_stamps[block].store(stamp, std::memory_order_relaxed);
+}
+
+void StemStorage::map_block(uint32_t block, const int16_t* samples)
+{
+    uint32_t first_segment = block * SEGMENTS_PER_BLOCK;
+    uint32_t end_segment = std::min(first_segment + SEGMENTS_PER_BLOCK, _segment_count);
+
+    _resident_blocks[block] = samples;
+    for (uint32_t index = first_segment; index < end_segment; ++index) {
+        uint32_t first = index * SEGMENT_FRAMES;
+        uint32_t count = std::min(SEGMENT_FRAMES, _frames - first);
+
+        if (!_silence.silent(first, count)) {
+            _segments[index].store(samples + 2 * (first - first_segment * SEGMENT_FRAMES));
+        }
+    }
+}
+
+void StemStorage::unmap_block(uint32_t block)
+{
+    uint32_t first_segment = block * SEGMENTS_PER_BLOCK;
+    uint32_t end_segment = std::min(first_segment + SEGMENTS_PER_BLOCK, _segment_count);
+
+    // Sequentially consistent, so that the cache's following read of the
+    // reader counter can't miss a render that still sees the old pointers
+    _resident_blocks[block] = nullptr;
+    for (uint32_t index = first_segment; index < end_segment; ++index) {
+        _segments[index].store(nullptr);
+    }
+}
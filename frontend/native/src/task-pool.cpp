@@ -0,0 +1,219 @@
+#include <task-pool.h>
+
+#include <algorithm>
+
+
+struct TaskPool::helper_job {
+    Task task;
+    bool done = false; // guarded by the pool's lock
+};
+
+TaskPool::TaskPool(int workers, int helpers)
+    : _quit(false)
+    , _idle_helpers(helpers)
+    , _helpers_quit(false)
+    , _peak_queued(0)
+    , _running(0)
+    , _completed(0)
+    , _cancelled(0)
+    , _coalesced(0)
+{
+    for (int i = 0; i < workers; ++i) {
+        _threads.emplace_back(&TaskPool::thread_main, this);
+    }
+
+    for (int i = 0; i < helpers; ++i) {
+        _helper_threads.emplace_back(&TaskPool::helper_main, this);
+    }
+}
+
+TaskPool::~TaskPool()
+{
+    {
+        std::lock_guard lock(_mutex);
+        _quit = true;
+    }
+
+    _task_queued.notify_all();
+    for (std::thread& thread : _threads) {
+        thread.join();
+    }
+
+    // Running tasks wait for their helpers, so these are idle by now
+    {
+        std::lock_guard lock(_mutex);
+        _helpers_quit = true;
+    }
+
+    _helper_queued.notify_all();
+    for (std::thread& thread : _helper_threads) {
+        thread.join();
+    }
+}
+
+void TaskPool::submit(Priority priority, Task task, CancelCheck cancelled, uint64_t coalesce_key,
+    Rank rank)
+{
+    std::unique_lock lock(_mutex);
+    std::deque<queued_task>& queue = _queues[static_cast<int>(priority)];
+
+    if (coalesce_key != 0) {
+        auto queued = std::find_if(queue.begin(), queue.end(), [coalesce_key](const queued_task& t) {
+            return t.coalesce_key == coalesce_key;
+        });
+
+        // Keep the place in the queue, so that resubmitting can't starve it
+        if (queued != queue.end()) {
+            queued->task = std::move(task);
+            queued->cancelled = std::move(cancelled);
+            queued->rank = std::move(rank);
+            ++_coalesced;
+            return;
+        }
+    }
+
+    queue.push_back({
+        .task = std::move(task),
+        .cancelled = std::move(cancelled),
+        .coalesce_key = coalesce_key,
+        .rank = std::move(rank),
+    });
+    _peak_queued = std::max(_peak_queued, queued_locked());
+
+    lock.unlock();
+    _task_queued.notify_one();
+}
+
+auto TaskPool::try_run_helper(Task task) -> HelperJob
+{
+    std::unique_lock lock(_mutex);
+
+    // Only if a helper will pick it up right away
+    if (_idle_helpers <= _helper_jobs.size()) {
+        return nullptr;
+    }
+
+    HelperJob job = std::make_shared<helper_job>();
+    job->task = std::move(task);
+    _helper_jobs.push_back(job);
+
+    lock.unlock();
+    _helper_queued.notify_one();
+    return job;
+}
+
+void TaskPool::wait_helper(const HelperJob& job)
+{
+    std::unique_lock lock(_mutex);
+    _helper_done.wait(lock, [&job]() { return job->done; });
+}
+
+task_pool_stats TaskPool::stats() const
+{
+    std::lock_guard lock(_mutex);
+
+    task_pool_stats stats;
+    for (const std::deque<queued_task>& queue : _queues) {
+        stats.queued.push_back(queue.size());
+    }
+
+    stats.peak_queued = _peak_queued;
+    stats.running = _running + (_helper_threads.size() - _idle_helpers);
+    stats.completed = _completed;
+    stats.cancelled = _cancelled;
+    stats.coalesced = _coalesced;
+    return stats;
+}
+
+void TaskPool::thread_main()
+{
+    std::unique_lock lock(_mutex);
+
+    while (true) {
+        _task_queued.wait(lock, [this]() { return _quit || queued_locked() > 0; });
+        if (_quit) {
+            return;
+        }
+
+        queued_task task = take_next_locked();
+
+        // The check may take other locks, don't hold the pool's one meanwhile
+        lock.unlock();
+        bool cancelled = task.cancelled && task.cancelled();
+        if (!cancelled) {
+            lock.lock();
+            ++_running;
+            lock.unlock();
+
+            task.task();
+        }
+
+        // Destroy the task (and whatever it captured) outside of the lock
+        task = {};
+
+        lock.lock();
+        if (cancelled) {
+            ++_cancelled;
+        } else {
+            --_running;
+            ++_completed;
+        }
+    }
+}
+
+void TaskPool::helper_main()
+{
+    std::unique_lock lock(_mutex);
+
+    while (true) {
+        _helper_queued.wait(lock, [this]() { return _helpers_quit || !_helper_jobs.empty(); });
+        if (_helpers_quit) {
+            return;
+        }
+
+        HelperJob job = std::move(_helper_jobs.front());
+        _helper_jobs.pop_front();
+        --_idle_helpers;
+        lock.unlock();
+
+        job->task();
+        job->task = nullptr; // release its captures before anyone is told
+
+        lock.lock();
+        ++_idle_helpers;
+        job->done = true;
+        _helper_done.notify_all();
+    }
+}
+
+auto TaskPool::take_next_locked() -> queued_task
+{
+    std::deque<queued_task>* queue = std::find_if(std::begin(_queues), std::end(_queues),
+        [](const std::deque<queued_task>& q) { return !q.empty(); });
+
+    // A few dozen tasks at most, ranking them all is cheap
+    auto next = queue->begin();
+    int64_t next_rank = next->rank ? next->rank() : 0;
+
+    for (auto it = std::next(queue->begin()); it != queue->end(); ++it) {
+        int64_t rank = it->rank ? it->rank() : 0;
+        if (rank < next_rank) {
+            next = it;
+            next_rank = rank;
+        }
+    }
+
+    queued_task task = std::move(*next);
+    queue->erase(next);
+    return task;
+}
+
+uint32_t TaskPool::queued_locked() const
+{
+    uint32_t queued = 0;
+    for (const std::deque<queued_task>& queue : _queues) {
+        queued += queue.size();
+    }
+
+    return queued;
+}
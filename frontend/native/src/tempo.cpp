@@ -5,85 +5,121 @@
 
 const int Tempo::TICKS_PER_STEP = 4;
 
+class Tempo::MapReader {
+public:
+    explicit MapReader(const Tempo& tempo)
+        : _tempo(tempo)
+    {
+        // Counted before loading, so that the writer can't miss this reader
+        _tempo._readers.fetch_add(1);
+        _map = _tempo._map.load();
+    }
+
+    ~MapReader()
+    {
+        _tempo._readers.fetch_sub(1);
+    }
+
+    const tempo_map& map() const
+    {
+        return *_map;
+    }
+
+private:
+    const Tempo& _tempo;
+    const tempo_map* _map;
+};
+
 Tempo::Tempo()
-    : _mode(TempoMode::STABLE)
-    , _stable_bpm(120.)
-    , _stable_time_sig(4)
+    : _map(nullptr)
+    , _readers(0)
     , _last_varying_segment(0)
 {
-    _stable_samples_per_beat = samples_per_beat_from_bpm(_stable_bpm);
+    set_stable_bpm(120., 4);
+}
+
+Tempo::~Tempo()
+{
+    delete _map.load();
 }
 
 void Tempo::set_stable_bpm(double bpm, uint32_t time_signature_numerator)
 {
-    std::lock_guard lock(_mutex);
+    auto map = std::make_unique<tempo_map>();
+    map->mode = TempoMode::STABLE;
+    map->stable_bpm = bpm;
+    map->stable_samples_per_beat = samples_per_beat_from_bpm(bpm);
+    map->stable_time_sig = time_signature_numerator;
 
-    _mode = TempoMode::STABLE;
-    _stable_bpm = bpm;
-    _stable_samples_per_beat = samples_per_beat_from_bpm(bpm);
-    _stable_time_sig = time_signature_numerator;
+    publish(std::move(map));
 }
 
 void Tempo::set_varying_bpm(const std::vector<tempo_tag>& tempo_def)
 {
-    std::lock_guard lock(_mutex);
-    
-    _mode = TempoMode::VARYING;
-    _varying_bpm = tempo_def;
-    _last_varying_segment = 0;
+    auto map = std::make_unique<tempo_map>();
+    map->mode = TempoMode::VARYING;
+    map->stable_bpm = 0.;
+    map->stable_samples_per_beat = 0.;
+    map->stable_time_sig = 0;
+    map->varying_bpm = tempo_def;
+
+    publish(std::move(map));
 }
 
 bool Tempo::bpm_stable() const
 {
-    std::lock_guard lock(_mutex);
-    return _mode == TempoMode::STABLE;
+    MapReader reader(*this);
+    return reader.map().mode == TempoMode::STABLE;
 }
 
 bool Tempo::bpm_varying() const
 {
-    std::lock_guard lock(_mutex);
-    return _mode == TempoMode::VARYING;
+    MapReader reader(*this);
+    return reader.map().mode == TempoMode::VARYING;
 }
 
 double Tempo::current_bpm(uint32_t track_position) const
 {
-    std::lock_guard lock(_mutex);
+    MapReader reader(*this);
+    const tempo_map& map = reader.map();
 
-    if (_mode == TempoMode::STABLE) {
-        return _stable_bpm;
+    if (map.mode == TempoMode::STABLE) {
+        return map.stable_bpm;
     }
 
-    if (_varying_bpm.size() < 2) {
+    if (map.varying_bpm.size() < 2) {
         return 0.;
     }
 
-    return varying_current_bpm(track_position);
+    return varying_current_bpm(map, track_position);
 }
 
 uint32_t Tempo::current_time_signature(uint32_t track_position) const
 {
-    std::lock_guard lock(_mutex);
+    MapReader reader(*this);
+    const tempo_map& map = reader.map();
 
-    if (_mode == TempoMode::STABLE) {
-        return _stable_time_sig;
+    if (map.mode == TempoMode::STABLE) {
+        return map.stable_time_sig;
     }
 
-    if (_varying_bpm.size() < 2) {
+    if (map.varying_bpm.size() < 2) {
         return 0;
     }
 
-    return varying_current_time_signature(track_position);
+    return varying_current_time_signature(map, track_position);
 }
 
 song_position Tempo::current_position(uint32_t track_position) const
 {
-    std::lock_guard lock(_mutex);
+    MapReader reader(*this);
+    const tempo_map& map = reader.map();
 
-    if (_mode == TempoMode::STABLE) {
-        return stable_current_position(track_position);
+    if (map.mode == TempoMode::STABLE) {
+        return stable_current_position(map, track_position);
     }
 
-    if (_varying_bpm.size() < 2) {
+    if (map.varying_bpm.size() < 2) {
         return song_position {
             .bar = 0,
             .step = 0,
@@ -91,22 +127,41 @@ song_position Tempo::current_position(uint32_t track_position) const
         };
     }
 
-    return varying_current_position(track_position);
+    return varying_current_position(map, track_position);
 }
 
 uint32_t Tempo::bar_sample(uint32_t bar) const
 {
-    std::lock_guard lock(_mutex);
+    MapReader reader(*this);
+    const tempo_map& map = reader.map();
 
-    if (_mode == TempoMode::STABLE) {
-        return stable_bar_sample(bar);
+    if (map.mode == TempoMode::STABLE) {
+        return stable_bar_sample(map, bar);
     }
 
-    if (_varying_bpm.size() < 2) {
+    if (map.varying_bpm.size() < 2) {
         return 0;
     }
 
-    return varying_bar_sample(bar);
+    return varying_bar_sample(map, bar);
+}
+
+void Tempo::publish(std::unique_ptr<tempo_map> map)
+{
+    std::lock_guard lock(_write_mutex);
+
+    const tempo_map* old_map = _map.exchange(map.release());
+    _last_varying_segment.store(0, std::memory_order_relaxed);
+
+    if (old_map) {
+        _retired_maps.emplace_back(old_map);
+    }
+
+    // Readers that come in from now on only see the new map. If none is in
+    // right now, none can be using the old ones anymore.
+    if (_readers.load() == 0) {
+        _retired_maps.clear();
+    }
 }
 
 double Tempo::samples_per_beat_from_bpm(double bpm)
@@ -114,35 +169,35 @@ double Tempo::samples_per_beat_from_bpm(double bpm)
     return AUDIO_SAMPLE_RATE * 60 / bpm;
 }
 
-song_position Tempo::stable_current_position(uint32_t track_position) const
+song_position Tempo::stable_current_position(const tempo_map& map, uint32_t track_position)
 {
-    double step_position = static_cast<double>(track_position) / _stable_samples_per_beat;
+    double step_position = static_cast<double>(track_position) / map.stable_samples_per_beat;
     uint32_t whole_ticks = static_cast<uint32_t>(floor(step_position * TICKS_PER_STEP));
     uint32_t whole_steps = whole_ticks / TICKS_PER_STEP;
-    uint32_t whole_bars = whole_steps / _stable_time_sig;
+    uint32_t whole_bars = whole_steps / map.stable_time_sig;
     
     return song_position {
         .bar = whole_bars + 1,
-        .step = whole_steps % _stable_time_sig + 1,
-        .tick = whole_ticks - whole_bars * _stable_time_sig * TICKS_PER_STEP + 1,
+        .step = whole_steps % map.stable_time_sig + 1,
+        .tick = whole_ticks - whole_bars * map.stable_time_sig * TICKS_PER_STEP + 1,
     };
 }
 
-uint32_t Tempo::stable_bar_sample(uint32_t bar) const
+uint32_t Tempo::stable_bar_sample(const tempo_map& map, uint32_t bar)
 {
     return static_cast<uint32_t>(
-        round(((bar - 1) * _stable_time_sig) * _stable_samples_per_beat));
+        round(((bar - 1) * map.stable_time_sig) * map.stable_samples_per_beat));
 }
 
-size_t Tempo::varying_bpm_binsearch(
-    size_t start, size_t end, uint32_t track_position) const
+size_t Tempo::varying_bpm_binsearch(const tempo_map& map,
+    size_t start, size_t end, uint32_t track_position)
 {
     while (end - start > 1) {
         size_t center = (start + end) >> 1;
 
-        if (track_position < _varying_bpm[center].sample) {
+        if (track_position < map.varying_bpm[center].sample) {
             end = center;
-        } else if (track_position > _varying_bpm[center].sample) {
+        } else if (track_position > map.varying_bpm[center].sample) {
             start = center;
         } else {
             return center;
@@ -152,66 +207,70 @@ size_t Tempo::varying_bpm_binsearch(
     return start;
 }
 
-size_t Tempo::varying_find_segment_index(uint32_t track_position) const
+size_t Tempo::varying_find_segment_index(const tempo_map& map, uint32_t track_position) const
 {
-    size_t segment_count = _varying_bpm.size();
+    size_t segment_count = map.varying_bpm.size();
 
     // Start of the track
-    if (track_position < _varying_bpm.front().sample) {
-        _last_varying_segment = 0;
+    if (track_position < map.varying_bpm.front().sample) {
+        _last_varying_segment.store(0, std::memory_order_relaxed);
         return 0;
     }
 
     // End of the track
-    if (track_position >= _varying_bpm.back().sample) {
-        _last_varying_segment = segment_count - 1;
+    if (track_position >= map.varying_bpm.back().sample) {
+        _last_varying_segment.store(segment_count - 1, std::memory_order_relaxed);
         return segment_count - 1;
     }
 
-    // Last search result (in case of sequential queries)
-    if (_last_varying_segment > 0 && _last_varying_segment < segment_count) {
-        if (track_position >= _varying_bpm[_last_varying_segment - 1].sample 
-            && track_position < _varying_bpm[_last_varying_segment].sample) {
+    // Last search result (in case of sequential queries). It's only a hint
+    // shared by all readers, so it's checked against this map first.
+    size_t last_segment = _last_varying_segment.load(std::memory_order_relaxed);
+    if (last_segment > 0 && last_segment < segment_count) {
+        if (track_position >= map.varying_bpm[last_segment - 1].sample 
+            && track_position < map.varying_bpm[last_segment].sample) {
             
-            return _last_varying_segment;
+            return last_segment;
         }
     }
 
     // If all pre-checks failed, perform bin-search
-    return varying_bpm_binsearch(0, _varying_bpm.size(), track_position) + 1;
+    size_t segment = varying_bpm_binsearch(map, 0, map.varying_bpm.size(), track_position) + 1;
+    _last_varying_segment.store(segment, std::memory_order_relaxed);
+    return segment;
 }
 
-double Tempo::varying_current_bpm(uint32_t track_position) const
+double Tempo::varying_current_bpm(const tempo_map& map, uint32_t track_position) const
 {
-    size_t index = varying_find_segment_index(track_position);
+    size_t index = varying_find_segment_index(map, track_position);
 
     if (index == 0) {
         return 0.;
     }
 
-    uint32_t sample_delta = _varying_bpm[index].sample - _varying_bpm[index - 1].sample;
-    uint32_t bar_delta = _varying_bpm[index].bar - _varying_bpm[index - 1].bar;
-    uint32_t step_delta = bar_delta * _varying_bpm[index - 1].time_signature_numerator;
+    uint32_t sample_delta = map.varying_bpm[index].sample - map.varying_bpm[index - 1].sample;
+    uint32_t bar_delta = map.varying_bpm[index].bar - map.varying_bpm[index - 1].bar;
+    uint32_t step_delta = bar_delta * map.varying_bpm[index - 1].time_signature_numerator;
 
     double steps_per_sample = static_cast<double>(step_delta) / static_cast<double>(sample_delta);
 
     return steps_per_sample * AUDIO_SAMPLE_RATE * 60;
 }
 
-uint32_t Tempo::varying_current_time_signature(uint32_t track_position) const
+uint32_t Tempo::varying_current_time_signature(const tempo_map& map, uint32_t track_position) const
 {
-    size_t index = varying_find_segment_index(track_position);
+    size_t index = varying_find_segment_index(map, track_position);
 
     if (index == 0) {
         return 0.;
     }
     
-    return _varying_bpm[index - 1].time_signature_numerator;
+    return map.varying_bpm[index - 1].time_signature_numerator;
 }
 
-song_position Tempo::varying_current_position(uint32_t track_position) const
+song_position Tempo::varying_current_position(const tempo_map& map, uint32_t track_position) const
 {
-    size_t index = varying_find_segment_index(track_position);
+    size_t index = varying_find_segment_index(map, track_position);
 
     if (index == 0) {
         return song_position {
@@ -221,12 +280,12 @@ song_position Tempo::varying_current_position(uint32_t track_position) const
         };
     }
 
-    uint32_t sample_delta = _varying_bpm[index].sample - _varying_bpm[index - 1].sample;
-    uint32_t bar_delta = _varying_bpm[index].bar - _varying_bpm[index - 1].bar;
-    uint32_t time_sig = _varying_bpm[index - 1].time_signature_numerator;
+    uint32_t sample_delta = map.varying_bpm[index].sample - map.varying_bpm[index - 1].sample;
+    uint32_t bar_delta = map.varying_bpm[index].bar - map.varying_bpm[index - 1].bar;
+    uint32_t time_sig = map.varying_bpm[index - 1].time_signature_numerator;
     uint32_t step_delta = bar_delta * time_sig;
 
-    double segment_sample = static_cast<double>(track_position - _varying_bpm[index - 1].sample);
+    double segment_sample = static_cast<double>(track_position - map.varying_bpm[index - 1].sample);
     double step_position_in_segment = segment_sample / sample_delta * step_delta;
 
     uint32_t whole_ticks = static_cast<uint32_t>(floor(step_position_in_segment * TICKS_PER_STEP));
@@ -234,25 +293,25 @@ song_position Tempo::varying_current_position(uint32_t track_position) const
     uint32_t whole_bars = whole_steps / time_sig;
 
     return song_position {
-        .bar = _varying_bpm[index - 1].bar + whole_bars,
+        .bar = map.varying_bpm[index - 1].bar + whole_bars,
         .step = whole_steps % time_sig + 1,
         .tick = whole_ticks - whole_bars * time_sig * TICKS_PER_STEP + 1,
     };
 }
 
-uint32_t Tempo::varying_bar_sample(uint32_t bar) const
+uint32_t Tempo::varying_bar_sample(const tempo_map& map, uint32_t bar)
 {
-    for (auto it = _varying_bpm.rbegin(); it != _varying_bpm.rend(); ++it) {
+    for (auto it = map.varying_bpm.rbegin(); it != map.varying_bpm.rend(); ++it) {
         if (it->bar > bar) {
             continue;
         }
 
         auto it_next = it;
 
-        if (it == _varying_bpm.rbegin()) {
-            --it;
+        if (it == map.varying_bpm.rbegin()) {
+            ++it; // past the last tag, extrapolate from the last segment
         } else {
-            ++it_next;
+            --it_next; // reverse iterators, so this is the following tag
         }
 
         double sample_delta = it_next->sample - it->sample;
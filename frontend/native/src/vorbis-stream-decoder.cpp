@@ -0,0 +1,162 @@
+#include <vorbis-stream-decoder.h>
+
+#include <stb_vorbis.h>
+
+#include <algorithm>
+#include <cmath>
+
+
+// Large enough for the longest possible Vorbis frame (blocksize 8192)
+const int VorbisStreamDecoder::FRAME_BUFFER_FRAMES = 4096;
+
+VorbisStreamDecoder::VorbisStreamDecoder(StemStorage::Writer& writer)
+    : _writer(writer)
+    , _vorbis(nullptr)
+    , _frame_buffer(std::make_unique<int16_t[]>(2 * FRAME_BUFFER_FRAMES))
+{
+}
+
+VorbisStreamDecoder::~VorbisStreamDecoder()
+{
+    if (_vorbis) {
+        stb_vorbis_close(_vorbis);
+    }
+}
+
+bool VorbisStreamDecoder::feed(const uint8_t* data, size_t bytes)
+{
+    _pending.insert(_pending.end(), data, data + bytes);
+    size_t consumed = 0;
+
+    if (!_vorbis) {
+        // Headers have to be complete before anything can be decoded
+        int used = 0;
+        int vorbis_error = 0;
+        _vorbis = stb_vorbis_open_pushdata(
+            _pending.data(), _pending.size(), &used, &vorbis_error, NULL);
+
+        if (!_vorbis) {
+            return vorbis_error == VORBIS_need_more_data;
+        }
+
+        consumed = used;
+    }
+
+    int used = 1;
+    while (used > 0 && !_writer.complete()) {
+        int channels = 0;
+        int samples = 0;
+        float** outputs = nullptr;
+
+        used = stb_vorbis_decode_frame_pushdata(_vorbis, _pending.data() + consumed, 
+            _pending.size() - consumed, &channels, &outputs, &samples);
+        consumed += used;
+
+        if (samples > 0) {
+            append_frame(channels, outputs, samples);
+        }
+    }
+
+    // What's left is a partial page, at most a few kB
+    _pending.erase(_pending.begin(), _pending.begin() + consumed);
+    return true;
+}
+
+bool VorbisStreamDecoder::finish()
+{
+    _pending.clear();
+    return _writer.complete();
+}
+
+bool VorbisStreamDecoder::decode_range(const uint8_t* data, size_t bytes, 
+    StemStorage::Writer& writer, const std::atomic_bool& cancelled)
+{
+    int vorbis_error = 0;
+    stb_vorbis* vorbis = stb_vorbis_open_memory(data, bytes, &vorbis_error, NULL);
+    if (vorbis == nullptr) {
+        return false;
+    }
+
+    // Seeking lands on the start of the frame that contains the position,
+    // frames before it are decoded and dropped to make the join exact
+    uint32_t position = writer.position();
+    if (position > 0 && !stb_vorbis_seek_frame(vorbis, position)) {
+        stb_vorbis_close(vorbis);
+        return false;
+    }
+
+    uint32_t skip = position - std::min<uint32_t>(position, stb_vorbis_get_sample_offset(vorbis));
+    auto frame_buffer = std::make_unique<int16_t[]>(2 * FRAME_BUFFER_FRAMES);
+
+    while (!writer.complete() && !cancelled) {
+        float** outputs = nullptr;
+        int channels = 0;
+        int samples = stb_vorbis_get_frame_float(vorbis, &channels, &outputs);
+        if (samples == 0) {
+            break;
+        }
+
+        int first = std::min<uint32_t>(skip, samples);
+        skip -= first;
+
+        for (; first < samples; first += FRAME_BUFFER_FRAMES) {
+            int count = std::min(samples - first, FRAME_BUFFER_FRAMES);
+            convert_to_stereo(channels, outputs, first, count, frame_buffer.get());
+            writer.append(frame_buffer.get(), count);
+        }
+    }
+
+    stb_vorbis_close(vorbis);
+    return writer.complete();
+}
+
+void VorbisStreamDecoder::append_frame(int channels, float** outputs, int samples)
+{
+    for (int first = 0; first < samples; first += FRAME_BUFFER_FRAMES) {
+        int count = std::min(samples - first, FRAME_BUFFER_FRAMES);
+        convert_to_stereo(channels, outputs, first, count, _frame_buffer.get());
+        _writer.append(_frame_buffer.get(), count);
+    }
+}
+
+void VorbisStreamDecoder::convert_to_stereo(int channels, float** outputs, int first, 
+    int samples, int16_t* output)
+{
+    // Same mapping as stb_vorbis' interleaved stereo output: up to 6 channels
+    // are folded into left and right (center to both), beyond that only the
+    // first two are kept
+    static const int LEFT = 1;
+    static const int RIGHT = 2;
+    static const int BOTH = LEFT | RIGHT;
+    static const int CHANNEL_POSITIONS[7][6] = {
+        { 0 },
+        { BOTH },
+        { LEFT, RIGHT },
+        { LEFT, BOTH, RIGHT },
+        { LEFT, RIGHT, LEFT, RIGHT },
+        { LEFT, BOTH, RIGHT, LEFT, RIGHT },
+        { LEFT, BOTH, RIGHT, LEFT, RIGHT, BOTH },
+    };
+
+    for (int i = 0; i < samples; ++i) {
+        float left = 0.f;
+        float right = 0.f;
+
+        if (channels == 2 || channels > 6) {
+            left = outputs[0][first + i];
+            right = outputs[1][first + i];
+        } else {
+            for (int channel = 0; channel < channels; ++channel) {
+                int position = CHANNEL_POSITIONS[channels][channel];
+                if (position & LEFT) left += outputs[channel][first + i];
+                if (position & RIGHT) right += outputs[channel][first + i];
+            }
+        }
+
+        // Same rounding and clipping as stb_vorbis' own int16 output
+        long l = std::lrintf(left * 32768.f);
+        long r = std::lrintf(right * 32768.f);
+        output[2 * i] = static_cast<int16_t>(std::clamp(l, -32768l, 32767l));
+        output[2 * i + 1] = static_cast<int16_t>(std::clamp(r, -32768l, 32767l));
+    }
+}
@@ -1,11 +1,64 @@
 #include <waveform-renderer.h>
 
+#include <pcm-block-cache.h>
+#include <silence-index.h>
+#include <stem-storage.h>
+
 #include <lodepng.h>
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
 #define SAMPLE_MAX 32767
 #define SAMPLE_MIN -32768
+#define READER_BUFFER_FRAMES PcmBlockCache::BLOCK_FRAMES
+
+
+/* 
+ * Reads a stem front to back, a whole cache block at a time, so that an
+ * evicted block of a lazy stem is decoded only once
+ */
+class WaveformRenderer::SampleReader {
+public:
+    explicit SampleReader(StemStorage& storage)
+        : _storage(storage)
+        , _buffer(std::make_unique<int16_t[]>(2 * READER_BUFFER_FRAMES))
+        , _first_frame(0)
+        , _frames(0)
+    {
+    }
+
+    uint32_t frames() const
+    {
+        return _storage.frames();
+    }
+
+    int16_t sample(uint32_t frame, int channel)
+    {
+        if (frame < _first_frame || frame >= _first_frame + _frames) {
+            fill(frame);
+        }
+
+        return _buffer[2 * (frame - _first_frame) + channel];
+    }
+
+private:
+    StemStorage& _storage;
+    std::unique_ptr<int16_t[]> _buffer;
+    uint32_t _first_frame;
+    uint32_t _frames;
+
+    void fill(uint32_t frame)
+    {
+        _first_frame = frame / READER_BUFFER_FRAMES * READER_BUFFER_FRAMES;
+        _frames = std::min<uint32_t>(READER_BUFFER_FRAMES, _storage.frames() - _first_frame);
+
+        if (!_storage.read(_first_frame, _frames, _buffer.get())) {
+            memset(_buffer.get(), 0, 2 * _frames * sizeof(int16_t));
+        }
+    }
+};
 
 
 WaveformRenderer::WaveformRenderer()
@@ -83,82 +136,91 @@ uint32_t WaveformRenderer::silence_min_length() const
 }
 
 std::vector<uint8_t> WaveformRenderer::render_waveform_to_png(
-    int32_t offset, uint32_t total_length, const int16_t* samples, uint32_t num_samples)
+    int32_t offset, uint32_t total_length, StemStorage& samples)
 {
     auto image = std::make_unique<pixel[]>(_output_width * _output_height);
     for (int i = 0; i < _output_width * _output_height; ++i) {
         image[i].red = image[i].green = image[i].blue = image[i].alpha = 0;
     }
 
-    process_waveform(image.get(), offset, total_length, samples, num_samples);
-    process_silence(image.get(), offset, total_length, samples, num_samples);
+    // A single pass over the samples, lazy stems are decoded on the way
+    std::vector<column_peaks> peaks(_output_width);
+    std::vector<silence_span> silences;
+    scan_samples(offset, total_length, samples, peaks, silences);
+
+    draw_waveform(image.get(), peaks);
+
+    int column = 0;
+    for (const silence_span& silence : silences) {
+        draw_silence(image.get(), total_length, column, silence.start, silence.end);
+    }
 
     std::vector<uint8_t> png;
     lodepng::encode(png, reinterpret_cast<uint8_t*>(image.get()), _output_width, _output_height);
     return png;
 }
 
-void WaveformRenderer::process_waveform(pixel* image, int32_t offset, 
-    uint32_t total_length, const int16_t* samples, uint32_t num_samples)
+void WaveformRenderer::scan_samples(int32_t offset, uint32_t total_length, StemStorage& samples,
+    std::vector<column_peaks>& peaks, std::vector<silence_span>& silences)
 {
+    SampleReader reader(samples);
+    uint32_t num_samples = reader.frames();
     uint32_t start_sample = 0;
+    uint32_t silence_start = 0;
 
     for (int x = 0; x < _output_width; ++x) {
         uint32_t end_sample = get_column_end_sample(x, total_length);
-        auto [hi_peak, low_peak] = get_column_peaks(
-            start_sample, end_sample, offset, samples, num_samples);
-
-        int hi_peak_px = peak_to_pixel(hi_peak);
-        int low_peak_px = peak_to_pixel(low_peak);
+        column_peaks& column = peaks[x];
+        column = { 0, 0 };
 
-        // Draw waveform
-        for (int y = hi_peak_px; y <= low_peak_px; ++y) {
-            auto& pixel = image[y * _output_width + x];
-            pixel.red = _color_red;
-            pixel.green = _color_green;
-            pixel.blue = _color_blue;
-            pixel.alpha = _color_alpha;
+        if (start_sample < end_sample) {
+            column = { SAMPLE_MIN, SAMPLE_MAX };
         }
 
-        start_sample = end_sample;
-    }
-}
+        for (uint32_t sample = start_sample; sample < end_sample; ++sample) {
+            int32_t stem_sample = sample - offset;
+            bool is_silence = true;
 
-void WaveformRenderer::process_silence(pixel* image, int32_t offset, 
-    uint32_t total_length, const int16_t* samples, uint32_t num_samples)
-{
-    uint32_t silence_start = 0;
-    int current_column = 0;
+            if (stem_sample >= 0 && stem_sample < static_cast<int32_t>(num_samples)) {
+                int16_t left = reader.sample(stem_sample, 0);
+                int16_t right = reader.sample(stem_sample, 1);
 
-    for (uint32_t sample = 0; sample < total_length; ++sample) {
-        int32_t stem_sample = sample - offset;
-        bool is_silence = false;
+                column.hi = std::max({ column.hi, left, right });
+                column.low = std::min({ column.low, left, right });
+                is_silence = SilenceIndex::is_silent(left, right, _silence_threshold);
+            }
 
-        if (stem_sample < 0 || stem_sample >= static_cast<int32_t>(num_samples)) {
-            is_silence = true;
-        } else {
-            int16_t left = samples[2 * stem_sample];
-            int16_t right = samples[2 * stem_sample + 1];
+            if (!is_silence) {
+                if (sample - silence_start >= _silence_min_length) {
+                    silences.push_back({ .start = silence_start, .end = sample });
+                }
 
-            is_silence = std::abs(left) < _silence_threshold 
-                       && std::abs(right) < _silence_threshold;
+                silence_start = sample + 1;
+            }
         }
 
-        if (!is_silence) {
-            uint32_t silence_length = sample - silence_start;
-            if (silence_length >= _silence_min_length) {
-                draw_silence(image, total_length, 
-                    current_column, silence_start, sample);
-            }
+        start_sample = end_sample;
+    }
 
-            silence_start = sample + 1;
-        }
+    if (total_length - silence_start >= _silence_min_length) {
+        silences.push_back({ .start = silence_start, .end = total_length });
     }
+}
 
-    uint32_t silence_length = total_length - silence_start;
-    if (silence_length >= _silence_min_length) {
-        draw_silence(image, total_length, 
-            current_column, silence_start, total_length);
+void WaveformRenderer::draw_waveform(pixel* image, const std::vector<column_peaks>& peaks)
+{
+    for (int x = 0; x < _output_width; ++x) {
+        int hi_peak_px = peak_to_pixel(peaks[x].hi);
+        int low_peak_px = peak_to_pixel(peaks[x].low);
+
+        // Draw waveform
+        for (int y = hi_peak_px; y <= low_peak_px; ++y) {
+            auto& pixel = image[y * _output_width + x];
+            pixel.red = _color_red;
+            pixel.green = _color_green;
+            pixel.blue = _color_blue;
+            pixel.alpha = _color_alpha;
+        }
     }
 }
 
@@ -197,29 +259,6 @@ void WaveformRenderer::blend_pixel(pixel& src, const pixel& over)
     src.blue = (over.blue * over_alpha + src.blue * src_alpha * (1.f - over_alpha)) / alpha;
 }
 
-std::pair<int16_t, int16_t> WaveformRenderer::get_column_peaks(uint32_t start_sample, 
-    uint32_t end_sample, int32_t offset, const int16_t* samples, uint32_t num_samples)
-{
-    if (start_sample >= end_sample) {
-        return std::make_pair(0, 0);
-    }
-
-    int16_t hi_peak = SAMPLE_MIN, low_peak = SAMPLE_MAX;
-    for (uint32_t sample = start_sample; sample < end_sample; ++sample) {
-        int32_t stem_sample = sample - offset;
-        if (stem_sample < 0) continue;
-        if (stem_sample >= static_cast<int32_t>(num_samples)) break;
-
-        int16_t left = samples[2 * stem_sample];
-        int16_t right = samples[2 * stem_sample + 1];
-        
-        hi_peak = std::max({ hi_peak, left, right });
-        low_peak = std::min({ low_peak, left, right });
-    }
-
-    return std::make_pair(hi_peak, low_peak);
-}
-
 uint32_t WaveformRenderer::get_column_end_sample(int x, uint32_t total_length) const {
     double fraction = static_cast<double>(x + 1) / _output_width;
     return static_cast<uint32_t>(round(fraction * total_length));
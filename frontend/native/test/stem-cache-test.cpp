@@ -0,0 +1,252 @@
+#include <fs-cache-backend.h>
+#include <stem-cache.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+// MEMFS under node, so nothing outlives the test
+#define TEST_CACHE_DIRECTORY "/stem-cache-test"
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+static int g_failures = 0;
+
+static void check(bool passed, const char* condition, int line)
+{
+    if (!passed) {
+        fprintf(stderr, "FAILED at line %d: %s\n", line, condition);
+        ++g_failures;
+    }
+}
+
+struct backend_counts {
+    int writes = 0;
+    int flushes = 0;
+};
+
+/* Counts what reaches the file system, to check that hits are batched */
+class CountingBackend : public CacheBackend {
+public:
+    CountingBackend(std::unique_ptr<CacheBackend> backend, backend_counts& counts)
+        : _backend(std::move(backend))
+        , _counts(counts)
+    {
+    }
+
+    std::vector<blob> list() override
+    {
+        return _backend->list();
+    }
+
+    bool read(const std::string& name, std::vector<uint8_t>& data) override
+    {
+        return _backend->read(name, data);
+    }
+
+    bool write(const std::string& name, const uint8_t* data, size_t bytes) override
+    {
+        ++_counts.writes;
+        return _backend->write(name, data, bytes);
+    }
+
+    void remove(const std::string& name) override
+    {
+        _backend->remove(name);
+    }
+
+    void flush() override
+    {
+        ++_counts.flushes;
+    }
+
+private:
+    std::unique_ptr<CacheBackend> _backend;
+    backend_counts& _counts;
+};
+
+static std::vector<uint8_t> make_blob(size_t bytes, uint8_t seed)
+{
+    std::vector<uint8_t> blob(bytes);
+    for (size_t i = 0; i < bytes; ++i) {
+        blob[i] = static_cast<uint8_t>(seed + i * 31);
+    }
+
+    return blob;
+}
+
+static std::unique_ptr<StemCache> open_cache(uint64_t capacity, backend_counts& counts)
+{
+    auto backend = std::make_unique<CountingBackend>(
+        std::make_unique<FsCacheBackend>(TEST_CACHE_DIRECTORY, false), counts);
+
+    return std::make_unique<StemCache>(std::move(backend), capacity);
+}
+
+static std::unique_ptr<StemCache> open_cache(uint64_t capacity)
+{
+    static backend_counts ignored;
+    return open_cache(capacity, ignored);
+}
+
+static void test_round_trip()
+{
+    auto cache = open_cache(1000);
+    std::vector<uint8_t> data;
+
+    CHECK(!cache->load("a.ogg", data));
+
+    CHECK(cache->store("a.ogg", make_blob(100, 1)));
+    CHECK(cache->store("a.ogg#decoded", make_blob(200, 2)));
+    CHECK(cache->used_bytes() == 300);
+
+    CHECK(cache->load("a.ogg", data) && data == make_blob(100, 1));
+    CHECK(cache->load("a.ogg#decoded", data) && data == make_blob(200, 2));
+
+    cache->remove("a.ogg");
+    CHECK(!cache->load("a.ogg", data));
+    CHECK(cache->used_bytes() == 200);
+
+    // Too big to be worth evicting everything else
+    CHECK(!cache->store("huge.ogg", make_blob(2000, 3)));
+    CHECK(!cache->load("huge.ogg", data));
+    CHECK(cache->load("a.ogg#decoded", data));
+}
+
+static void test_lru_eviction()
+{
+    auto cache = open_cache(300);
+    std::vector<uint8_t> data;
+
+    cache->store("a", make_blob(100, 1));
+    cache->store("b", make_blob(100, 2));
+    cache->store("c", make_blob(100, 3));
+
+    // `a` is used again, so `b` is the least recently used one now
+    CHECK(cache->load("a", data));
+    cache->store("d", make_blob(100, 4));
+
+    CHECK(cache->load("a", data));
+    CHECK(!cache->load("b", data));
+    CHECK(cache->load("c", data));
+    CHECK(cache->load("d", data));
+    CHECK(cache->used_bytes() == 300);
+
+    cache->set_capacity(150);
+    cache->store("e", make_blob(100, 5));
+    CHECK(cache->used_bytes() == 100);
+    CHECK(cache->load("e", data));
+}
+
+static void test_spare_session()
+{
+    std::vector<uint8_t> data;
+    {
+        auto cache = open_cache(300);
+        cache->store("old", make_blob(100, 1));
+    }
+
+    // Files of an earlier session make room, those of this one don't
+    auto cache = open_cache(300);
+    CHECK(cache->store("a", make_blob(100, 2), true));
+    CHECK(cache->store("b", make_blob(100, 3), true));
+    CHECK(cache->store("c", make_blob(100, 4), true));
+    CHECK(!cache->load("old", data));
+
+    CHECK(!cache->store("d", make_blob(100, 5), true));
+    CHECK(!cache->load("d", data));
+    CHECK(cache->load("a", data) && data == make_blob(100, 2));
+    CHECK(cache->load("b", data));
+    CHECK(cache->load("c", data));
+
+    // Without sparing them, the least recently used one goes as usual
+    CHECK(cache->store("d", make_blob(100, 5)));
+    CHECK(!cache->load("a", data));
+    CHECK(cache->load("d", data));
+}
+
+static void test_batched_hits()
+{
+    backend_counts counts;
+    auto cache = open_cache(1000, counts);
+    std::vector<uint8_t> data;
+
+    cache->store("a", make_blob(100, 1));
+    cache->store("b", make_blob(100, 2));
+    int writes = counts.writes;
+    int flushes = counts.flushes;
+
+    // Hits only reorder the index in memory
+    for (int i = 0; i < 20; ++i) {
+        CHECK(cache->load(i % 2 ? "a" : "b", data));
+    }
+
+    CHECK(counts.writes == writes);
+    CHECK(counts.flushes == flushes);
+
+    // ...which is written when the cache goes away
+    cache.reset();
+    CHECK(counts.writes == writes + 1);
+}
+
+static void test_reopen()
+{
+    std::vector<uint8_t> data;
+    {
+        auto cache = open_cache(300);
+        cache->store("a", make_blob(100, 1));
+        cache->store("b", make_blob(100, 2));
+        cache->store("c", make_blob(100, 3));
+        CHECK(cache->load("a", data));
+    }
+
+    // A file that never made it to the index
+    FsCacheBackend raw(TEST_CACHE_DIRECTORY, false);
+    std::vector<uint8_t> stray = make_blob(10, 9);
+    raw.write("0123456789abcdef", stray.data(), stray.size());
+
+    backend_counts counts;
+    auto cache = open_cache(300, counts);
+    CHECK(cache->used_bytes() == 300);
+    CHECK(raw.list().size() == 4); // three files and the index
+    CHECK(counts.writes == 1);  // the index, without the stray file
+
+    // The LRU order survived, `b` goes first
+    cache->store("d", make_blob(100, 4));
+    CHECK(!cache->load("b", data));
+    CHECK(cache->load("a", data) && data == make_blob(100, 1));
+    CHECK(cache->load("c", data));
+
+    // Nothing to fix: the index isn't written at all
+    cache.reset();
+    backend_counts reopened_counts;
+    auto reopened = open_cache(300, reopened_counts);
+    CHECK(reopened_counts.writes == 0);
+}
+
+int main()
+{
+    std::vector<void (*)()> tests = {
+        test_round_trip,
+        test_lru_eviction,
+        test_spare_session,
+        test_batched_hits,
+        test_reopen,
+    };
+
+    for (void (*test)() : tests) {
+        std::filesystem::remove_all(TEST_CACHE_DIRECTORY);
+        std::filesystem::create_directory(TEST_CACHE_DIRECTORY);
+        test();
+    }
+
+    if (g_failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", g_failures);
+        return 1;
+    }
+
+    printf("All stem cache tests passed\n");
+    return 0;
+}
@@ -8,6 +8,8 @@ interface Window {
 
 interface GlissandoModule extends EmscriptenModule {
   getGlobalMixer: () => NativeMixer;
+  getAudibleClockAddress: () => number;
+  attachStemCache: () => void;
   VectorTempoTag: typeof CppVector<TempoTag>;
   VectorStemInfo: typeof CppVector<StemInfo>;
 }
@@ -16,12 +18,33 @@ interface GlissandoModule extends EmscriptenModule {
 interface StemInfo {
   id: number;
   path: string;
+  format: 'vorbis' | 'flac';
   samples: number;
   offset: number;
   gainDb: number;
   pan: number;
 }
 
+// Corresponding definition in frontend/native/include/performance-monitor.h
+interface PerformanceStats {
+  mixdownBucketMs: number;
+  mixdownHistogram: number[];
+  mixdownMeanMs: number;
+  mixdownMaxMs: number;
+  fillBucketSamples: number;
+  fillHistogram: number[];
+  worstJitterMs: number;
+  underflowCount: number;
+  underflowTimestampsMs: number[];
+  outputLatency: number;
+  taskQueueDepths: number[];
+  taskQueuePeak: number;
+  tasksRunning: number;
+  tasksCompleted: number;
+  tasksCancelled: number;
+  tasksCoalesced: number;
+}
+
 // Corresponding definition in frontend/native/include/tempo.h
 interface SongPosition {
   bar: number;
@@ -60,8 +83,10 @@ interface NativeMixer {
   setPlaybackPosition: (sampleNum: number) => void;
   getPlaybackPosition: () => number;
   getPlaybackPositionBst: () => SongPosition;
+  getSongPosition: (sampleNum: number) => SongPosition;
   getBarSample: (bar: number) => number;
   getSampleRate: () => number;
+  getOutputSampleRate: () => number;
   setMetronomeEnabled: (enabled: boolean) => void;
   toggleMetronome: () => void;
   isMetronomeEnabled: () => boolean;
@@ -84,7 +109,26 @@ interface NativeMixer {
   unmuteAll: () => void;
   isStemMuted: (stemId: number) => boolean;
   isStemSoloed: (stemId: number) => boolean;
+  setLazyDecoding: (enabled: boolean) => void;
+  isLazyDecoding: () => boolean;
+  setPcmCacheSizeMb: (megabytes: number) => void;
+  getPcmCacheSizeMb: () => number;
+  setStemCacheSizeMb: (megabytes: number) => void;
+  getStemCacheSizeMb: () => number;
+  setDecodedStemCacheSizeMb: (megabytes: number) => void;
+  getDecodedStemCacheSizeMb: () => number;
+  setRetainedStemsSizeMb: (megabytes: number) => void;
+  getRetainedStemsSizeMb: () => number;
   getLimiterReductionDb: () => number;
+  setOutputTrimDb: (trimDb: number) => void;
+  getOutputTrimDb: () => number;
+  setRenderBlockSize: (frames: number) => void;
+  getRenderBlockSize: () => number;
+  setOutputLatencyBounds: (minSamples: number, maxSamples: number) => void;
+  getOutputLatency: () => number;
+  getPerformanceStats: () => PerformanceStats;
+  setDirectRendering: (enabled: boolean) => void;
+  isDirectRendering: () => boolean;
 }
 
 type FormType = { bar: number; name: string; }[];
@@ -1,5 +1,6 @@
 import { useCallback, useState } from 'react';
 
+import { useAudiblePosition } from '../hooks/useAudiblePosition';
 import { useNative } from '../hooks/useNative';
 import { usePlaybackUpdate } from '../hooks/usePlaybackUpdate';
 
@@ -33,10 +34,12 @@ function EditorTimer() {
   });
 
   const sampleRate = native?.getSampleRate() || 0;
+  const getAudiblePosition = useAudiblePosition();
 
   usePlaybackUpdate(useCallback((mixer: NativeMixer) => {
-    setTimestamp(getTimestamp(mixer.getPlaybackPosition(), sampleRate, mixer.getPlaybackPositionBst()));
-  }, [sampleRate]));
+    const position = Math.floor(getAudiblePosition() ?? mixer.getPlaybackPosition());
+    setTimestamp(getTimestamp(position, sampleRate, mixer.getSongPosition(position)));
+  }, [sampleRate, getAudiblePosition]));
   
   return (
     <>
@@ -179,13 +179,24 @@ export interface StemData {
   pan: number;
 }
 
-function stemDataToStemInfo(pathPrefix: string, data: StemData): StemInfo {
+// Browsers report 10 Mbps at most
+const LOSSLESS_MIN_DOWNLINK_MBPS = 10;
+
+// FLAC stems are several times larger than Vorbis ones, but they decode
+// much faster. It's only worth downloading them on a fast connection.
+function preferLosslessStems(): boolean {
+  const connection = (navigator as Navigator & { connection?: { downlink?: number } }).connection;
+  return (connection?.downlink ?? 0) >= LOSSLESS_MIN_DOWNLINK_MBPS;
+}
+
+function stemDataToStemInfo(pathPrefix: string, data: StemData, lossless: boolean): StemInfo {
   return {
     id: data.id,
     gainDb: data.gainDecibels,
     offset: data.offset,
     pan: data.pan,
-    path: pathPrefix + '/' + data.path,
+    path: pathPrefix + '/' + (lossless ? data.losslessPath : data.path),
+    format: lossless ? 'flac' : 'vorbis',
     samples: data.samples,
   };
 }
@@ -214,8 +225,9 @@ function EditorTracks(props: EditorTracksProps) {
 
   useEffect(() => {
     const vector = new window.Module.VectorStemInfo();
+    const lossless = preferLosslessStems();
 
-    data.forEach((item) => vector.push_back(stemDataToStemInfo(stemLocationPrefix!, item)));
+    data.forEach((item) => vector.push_back(stemDataToStemInfo(stemLocationPrefix!, item, lossless)));
 
     native!.updateStemInfo(vector);
     vector.delete();
@@ -1,6 +1,7 @@
 import { useCallback, useState } from 'react';
 import { styled } from '@mui/system';
 
+import { useAudiblePosition } from '../hooks/useAudiblePosition';
 import { usePlaybackUpdate } from '../hooks/usePlaybackUpdate';
 
 const playbackIndicatorColor = '#0f0';
@@ -43,14 +44,16 @@ const PlaybackBarTip = styled('div')(({ theme }) => ({
 
 function PlaybackIndicator() {
   const [ position, setPosition ] = useState<number | undefined>(undefined);
+  const getAudiblePosition = useAudiblePosition();
 
   usePlaybackUpdate(useCallback((mixer: NativeMixer) => {
     if (mixer.getPlaybackState() === 'stop') {
       setPosition(undefined);
     } else {
-      setPosition(mixer.getPlaybackPosition() / mixer.getTrackLength());
+      const audiblePosition = getAudiblePosition() ?? mixer.getPlaybackPosition();
+      setPosition(audiblePosition / mixer.getTrackLength());
     }
-  }, []));
+  }, [getAudiblePosition]));
 
   return (
     <>
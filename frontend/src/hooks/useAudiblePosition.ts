@@ -0,0 +1,85 @@
+import { useCallback, useContext, useMemo } from 'react';
+
+import { WasmContext } from '../components/WasmContext';
+import { useNative } from './useNative';
+
+// Corresponding definition in frontend/native/include/audible-clock.h
+const CONTEXT_TIME_OFFSET = 0;
+const SEQUENCE_OFFSET = 8;
+const POSITION_OFFSET = 12;
+const PLAYING_OFFSET = 16;
+const MAX_READ_ATTEMPTS = 4;
+
+interface AudibleClockRecord {
+  contextTime: number;
+  position: number;
+  playing: boolean;
+}
+
+function readAudibleClock(module: GlissandoModule, address: number): AudibleClockRecord | undefined {
+  const sequenceIndex = (address + SEQUENCE_OFFSET) >> 2;
+
+  for (let attempt = 0; attempt < MAX_READ_ATTEMPTS; ++attempt) {
+    const sequence = Atomics.load(module.HEAPU32, sequenceIndex);
+    if (sequence & 1) {
+      continue; // the worklet is updating the record right now
+    }
+
+    const record = {
+      contextTime: module.HEAPF64[(address + CONTEXT_TIME_OFFSET) >> 3],
+      position: module.HEAPU32[(address + POSITION_OFFSET) >> 2],
+      playing: module.HEAPU32[(address + PLAYING_OFFSET) >> 2] !== 0,
+    };
+
+    if (Atomics.load(module.HEAPU32, sequenceIndex) === sequence) {
+      return record;
+    }
+  }
+
+  return undefined;
+}
+
+function getAudibleContextTime(audioContext: AudioContext): number {
+  const timestamp = audioContext.getOutputTimestamp?.();
+  if (timestamp?.contextTime !== undefined) {
+    return timestamp.contextTime;
+  }
+
+  return audioContext.currentTime - audioContext.baseLatency - (audioContext.outputLatency || 0);
+}
+
+/**
+ * Returns a function that tells which song sample is being heard right now.
+ * 
+ * Unlike `getPlaybackPosition()`, which reports where the mixer is writing, this
+ * compensates for the output buffer and the WebAudio output latency. It reads
+ * the clock published by the audio worklet straight from the wasm heap,
+ * so it is cheap enough to be called on every animation frame.
+ */
+export function useAudiblePosition(): () => number | undefined {
+  const ctx = useContext(WasmContext);
+  const [ native, ] = useNative();
+
+  const module = ctx.module;
+  const address = useMemo(() => module?.getAudibleClockAddress(), [module]);
+  const sampleRate = useMemo(() => native?.getSampleRate(), [native]);
+
+  return useCallback(() => {
+    const audioContext = window.audioContext;
+    if (!module || address === undefined || !sampleRate || !audioContext) {
+      return native?.getPlaybackPosition();
+    }
+
+    const clock = readAudibleClock(module, address);
+    if (!clock) {
+      return native?.getPlaybackPosition();
+    }
+
+    if (!clock.playing) {
+      return clock.position;
+    }
+
+    const elapsed = getAudibleContextTime(audioContext) - clock.contextTime;
+    return Math.max(0, clock.position + elapsed * sampleRate);
+  }, [module, address, sampleRate, native]);
+}